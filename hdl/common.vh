@@ -533,4 +533,12 @@
 `endif
 `endif
 
+// Bits of sim_features. A simulator model built with SIM_FEATURES
+// (gen_config 11) has every optional feature below and these turn them
+// on or off at run time.
+`define FEATURE_EXTENSIONS 0
+`define FEATURE_MATH       1
+`define FEATURE_HIRES      2
+`define FEATURE_BLITTER    3
+
 `endif // common_vh_
@@ -130,6 +130,9 @@ module registers
            input spi_lock,
            input extensions_lock,
            input persistence_lock,
+`ifdef SIM_FEATURES
+           input [3:0] sim_features,
+`endif
 `ifdef GEN_LUMA_CHROMA
 `ifdef CONFIGURABLE_LUMAS
            output reg [5:0] blanking_level,
@@ -212,6 +215,20 @@ reg[7:0] magic_3;
 reg[7:0] magic_4;
 reg [1:0] extra_regs_activation_ctr;
 reg extra_regs_activated;
+
+// Optional features the simulator's superset model can switch off at
+// run time. Everything that was compiled in is on otherwise.
+`ifdef SIM_FEATURES
+wire feat_extensions = sim_features[`FEATURE_EXTENSIONS];
+wire feat_math = sim_features[`FEATURE_MATH];
+wire feat_hires = sim_features[`FEATURE_HIRES];
+wire feat_blitter = sim_features[`FEATURE_BLITTER];
+`else
+wire feat_extensions = 1'b1;
+wire feat_math = 1'b1;
+wire feat_hires = 1'b1;
+wire feat_blitter = 1'b1;
+`endif
 reg [1:0] spi_reg_activation_ctr;
 reg spi_reg_activated;
 
@@ -596,7 +613,7 @@ begin
         flag_persist <= 1'b0;
 
 `ifdef SIMULATOR_BOARD
-        extra_regs_activated <= 1'b1;
+        extra_regs_activated <= feat_extensions;
 `ifdef HIRES_MODES
 	`ifdef HIRES_TEXT
         // Test mode 0 : Text
@@ -1176,7 +1193,8 @@ begin
                                 /* "2" */ 8'd50:
                                     // extensions_lock must CLOSED
                                     if (extra_regs_activation_ctr == 2'd3
-                                            && ~extensions_lock)
+                                            && ~extensions_lock
+                                            && feat_extensions)
                                         extra_regs_activated <= 1'b1;
                                     else
                                         extra_regs_activation_ctr <= 2'd0;
@@ -1188,23 +1206,23 @@ begin
                     end else begin /* extra_regs_activated */
                         case (addr_latched[5:0])
 `ifdef WITH_MATH
-                            /* 0x2f */ 6'h2f: begin
+                            /* 0x2f */ 6'h2f: if (feat_math) begin
                                 u_op_1[15:8] <= dbi[7:0];
                                 s_op_1[15:8] <= dbi[7:0];
                             end
-                            /* 0x30 */ 6'h30: begin
+                            /* 0x30 */ 6'h30: if (feat_math) begin
                                 u_op_1[7:0] <= dbi[7:0];
                                 s_op_1[7:0] <= dbi[7:0];
                             end
-                            /* 0x31 */ 6'h31: begin
+                            /* 0x31 */ 6'h31: if (feat_math) begin
                                 u_op_2[15:8] <= dbi[7:0];
                                 s_op_2[15:8] <= dbi[7:0];
                             end
-                            /* 0x32 */ 6'h32: begin
+                            /* 0x32 */ 6'h32: if (feat_math) begin
                                 u_op_2[7:0] <= dbi[7:0];
                                 s_op_2[7:0] <= dbi[7:0];
                             end
-                            /* 0x33 */ 6'h33: begin
+                            /* 0x33 */ 6'h33: if (feat_math) begin
                                 operator <= dbi[7:0];
                             end
 `endif
@@ -1285,7 +1303,7 @@ begin
                             begin
 `ifdef HIRES_MODES
                                 hires_mode <= dbi[7:5];
-                                hires_enabled <= dbi[`HIRES_ENABLE];
+                                hires_enabled <= dbi[`HIRES_ENABLE] & feat_hires;
                                 hires_allow_bad <= dbi[`HIRES_ALLOW_BAD];
                                 hires_char_pixel_base <= dbi[2:0];
 `endif
@@ -1355,7 +1373,7 @@ begin
                                         video_ram_copy_dir <= 1'b1;
                                         dma_done <= 1'b0;
 `ifdef WITH_BLITTER
-                                    end else if (dbi[5]) begin
+                                    end else if (dbi[5] && feat_blitter) begin
                                         // Set Blitter SRC Info
                                         blit_width <= u_op_1[9:0];
                                         blit_height <= u_op_2[9:0];
@@ -1366,7 +1384,7 @@ begin
                                             port_lo_2 * port_hi_2;
                                         blit_src_x <= port_lo_1[1:0];
                                         blit_src_stride <= port_hi_2;
-                                    end else if (dbi[6]) begin
+                                    end else if (dbi[6] && feat_blitter) begin
                                         // Set Blitter DST Info & Execute
                                         blit_flags <= u_op_1[15:8];
                                         // dst_ptr = base + x / PIXELS_PER_BYTE + y * STRIDE
@@ -55,6 +55,10 @@ module top(
            output [5:0] chroma,  // chroma out
 `endif
 
+`ifdef SIM_FEATURES
+           input [3:0] sim_features, // run time feature mask
+`endif
+
 `ifdef WITH_EXTENSIONS
            input cfg1,
            input cfg2,
@@ -203,6 +207,9 @@ vicii vic_inst(
           .spi_lock(cfg1),
           .extensions_lock(cfg2),
           .persistence_lock(cfg3),
+`ifdef SIM_FEATURES
+          .sim_features(sim_features),
+`endif
 `ifdef HAVE_FLASH
           .flash_s(flash_s),
 `endif
@@ -105,6 +105,9 @@ module vicii
            input spi_lock,
            input extensions_lock,
            input persistence_lock,
+`ifdef SIM_FEATURES
+           input [3:0] sim_features,
+`endif
 `ifdef WITH_SPI
            output spi_d,
            input  spi_q,
@@ -1053,6 +1056,9 @@ registers vic_registers(
               .spi_lock(spi_lock),
               .extensions_lock(extensions_lock),
               .persistence_lock(persistence_lock),
+`ifdef SIM_FEATURES
+              .sim_features(sim_features),
+`endif
 `ifdef GEN_LUMA_CHROMA
 `ifdef CONFIGURABLE_LUMAS
               .blanking_level(blanking_level),
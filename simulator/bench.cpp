@@ -0,0 +1,262 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "log.h"
+
+// Where the scenario programs go, RAM that's always RAM
+#define BENCH_ORG 0xc000
+
+// Zero page byte the dma and blit loops count with
+#define BENCH_COUNTER 0x02
+
+// Sprite data block and its pointer value
+#define BENCH_SPRITE 0x0340
+
+// Extension registers (see doc/REGISTERS.md)
+#define VIDEO_MODE1     0xd037
+#define VIDEO_MEM_1_IDX 0xd035
+#define VIDEO_MEM_2_IDX 0xd036
+#define VIDEO_MEM_1_LO  0xd039
+#define VIDEO_MEM_1_HI  0xd03a
+#define VIDEO_MEM_1_VAL 0xd03b
+#define VIDEO_MEM_2_LO  0xd03c
+#define VIDEO_MEM_2_HI  0xd03d
+#define VIDEO_MEM_FLAGS 0xd03f
+
+#define HIRES_ENABLE    0x10
+#define PORTS_DMA       0x0f
+
+const char* bench_scenarios[] = {
+   "idle", "text", "sprites",
+   "hires0", "hires1", "hires2", "hires3", "hires4",
+   "dma", "blit",
+   NULL
+};
+
+// Just enough of an assembler to write the scenarios
+struct asm6502 {
+   unsigned char* ram;
+   unsigned short pc;
+};
+
+static void emit(struct asm6502* a, unsigned char b) {
+   a->ram[a->pc++] = b;
+}
+
+static void emitAbs(struct asm6502* a, unsigned char op, unsigned short addr) {
+   emit(a, op);
+   emit(a, addr & 0xff);
+   emit(a, addr >> 8);
+}
+
+static void branch(struct asm6502* a, unsigned char op, unsigned short target) {
+   emit(a, op);
+   emit(a, (unsigned char) (target - (a->pc + 1)));
+}
+
+static void ldaImm(struct asm6502* a, unsigned char v) { emit(a, 0xa9); emit(a, v); }
+static void cmpImm(struct asm6502* a, unsigned char v) { emit(a, 0xc9); emit(a, v); }
+static void ldaAbs(struct asm6502* a, unsigned short addr) { emitAbs(a, 0xad, addr); }
+static void staAbs(struct asm6502* a, unsigned short addr) { emitAbs(a, 0x8d, addr); }
+static void bitAbs(struct asm6502* a, unsigned short addr) { emitAbs(a, 0x2c, addr); }
+static void incAbs(struct asm6502* a, unsigned short addr) { emitAbs(a, 0xee, addr); }
+static void jmp(struct asm6502* a, unsigned short addr) { emitAbs(a, 0x4c, addr); }
+static void bne(struct asm6502* a, unsigned short target) { branch(a, 0xd0, target); }
+static void bmi(struct asm6502* a, unsigned short target) { branch(a, 0x30, target); }
+
+static void poke(struct asm6502* a, unsigned short addr, unsigned char v) {
+   ldaImm(a, v);
+   staAbs(a, addr);
+}
+
+// Spin until a register reads back 0
+static void waitZero(struct asm6502* a, unsigned short addr) {
+   unsigned short loop = a->pc;
+   ldaAbs(a, addr);
+   bne(a, loop);
+}
+
+// Spin until raster line (below 256)
+static void waitLine(struct asm6502* a, unsigned char line) {
+   unsigned short loop = a->pc;
+   bitAbs(a, 0xd011);
+   bmi(a, loop);
+   ldaAbs(a, 0xd012);
+   cmpImm(a, line);
+   bne(a, loop);
+}
+
+// Screen and character data that isn't all the same so the sequencer
+// has something to do. The char ROM is used instead if we have it.
+static void textData(struct c64* m) {
+   for (int i = 0; i < 1000; i++) {
+      m->ram[0x0400 + i] = i & 0xff;
+      m->color[i] = (i / 40 + i) & 0x0f;
+   }
+   for (int i = 0; i < 0x0800; i++)
+      m->ram[0x1000 + i] = (i * 37) ^ (i >> 3);
+}
+
+static void textMode(struct asm6502* a) {
+   poke(a, 0xd011, 0x1b);
+   poke(a, 0xd016, 0x08);
+   poke(a, 0xd018, 0x14);
+   poke(a, 0xd020, 0x0e);
+   poke(a, 0xd021, 0x06);
+}
+
+static void hiresMode(struct asm6502* a, int mode) {
+   poke(a, VIDEO_MODE1, (mode << 5) | HIRES_ENABLE);
+}
+
+// 8 Y expanded sprites side by side, moved down 42 lines once each
+// band has started so every line from 51 to 260 has sprite DMA.
+static void sprites(struct c64* m, struct asm6502* a) {
+   static const unsigned char bands[] = { 50, 92, 134, 176, 218 };
+   int numBands = sizeof(bands) / sizeof(bands[0]);
+
+   memset(&m->ram[BENCH_SPRITE], 0xff, 63);
+   for (int i = 0; i < 8; i++) {
+      m->ram[0x07f8 + i] = BENCH_SPRITE / 64;
+      int x = 24 + i * 40;
+      poke(a, 0xd000 + i * 2, x & 0xff);
+      poke(a, 0xd027 + i, i + 1);
+   }
+   poke(a, 0xd010, 0xc0);
+   poke(a, 0xd017, 0xff);
+   ldaImm(a, bands[0]);
+   for (int i = 0; i < 8; i++)
+      staAbs(a, 0xd001 + i * 2);
+   poke(a, 0xd015, 0xff);
+
+   unsigned short top = a->pc;
+   for (int b = 0; b < numBands; b++) {
+      // Once the last band has started, the first one is next frame's
+      unsigned char next = bands[(b + 1) % numBands];
+      waitLine(a, bands[b] + 2);
+      ldaImm(a, next);
+      for (int i = 0; i < 8; i++)
+         staAbs(a, 0xd001 + i * 2);
+   }
+   jmp(a, top);
+}
+
+// Fill 32K of video memory with the counter, copy 16K of it and go
+// again with the next value
+static void dma(struct asm6502* a) {
+   poke(a, VIDEO_MEM_FLAGS, PORTS_DMA);
+
+   unsigned short top = a->pc;
+   poke(a, VIDEO_MEM_1_HI, 0x00);
+   poke(a, VIDEO_MEM_1_LO, 0x00);
+   poke(a, VIDEO_MEM_1_IDX, 0x00);
+   poke(a, VIDEO_MEM_2_IDX, 0x80);
+   ldaAbs(a, BENCH_COUNTER);
+   staAbs(a, VIDEO_MEM_2_LO);
+   poke(a, VIDEO_MEM_1_VAL, 4);
+   waitZero(a, VIDEO_MEM_2_IDX);
+
+   poke(a, VIDEO_MEM_1_HI, 0x80);
+   poke(a, VIDEO_MEM_1_LO, 0x00);
+   poke(a, VIDEO_MEM_2_HI, 0x00);
+   poke(a, VIDEO_MEM_2_LO, 0x00);
+   poke(a, VIDEO_MEM_1_IDX, 0x00);
+   poke(a, VIDEO_MEM_2_IDX, 0x40);
+   poke(a, VIDEO_MEM_1_VAL, 1);
+   waitZero(a, VIDEO_MEM_2_IDX);
+
+   incAbs(a, BENCH_COUNTER);
+   jmp(a, top);
+}
+
+// XOR a 64x64 block from the top left corner onto the middle of the
+// screen, one pixel further right each pass
+static void blit(struct asm6502* a) {
+   poke(a, VIDEO_MEM_FLAGS, PORTS_DMA);
+
+   unsigned short top = a->pc;
+   poke(a, 0xd02f, 0);    // width
+   poke(a, 0xd030, 64);
+   poke(a, 0xd031, 0);    // height
+   poke(a, 0xd032, 64);
+   poke(a, 0xd035, 0);    // src ptr
+   poke(a, 0xd036, 0);
+   poke(a, 0xd039, 0);    // src x
+   poke(a, 0xd03a, 0);
+   poke(a, 0xd03b, 0);    // src y
+   poke(a, 0xd03c, 160);  // stride
+   poke(a, 0xd03d, 32);   // set src
+
+   poke(a, 0xd02f, 3);    // XOR
+   poke(a, 0xd035, 0);    // dst ptr
+   poke(a, 0xd036, 0);
+   ldaAbs(a, BENCH_COUNTER);
+   staAbs(a, 0xd039);     // dst x
+   poke(a, 0xd03a, 0);
+   poke(a, 0xd03b, 100);  // dst y
+   poke(a, 0xd03c, 160);
+   poke(a, 0xd03d, 64);   // set dst and go
+   waitZero(a, 0xd03c);
+
+   incAbs(a, BENCH_COUNTER);
+   jmp(a, top);
+}
+
+int bench_load(struct c64* m, const char* name) {
+   struct asm6502 a = { m->ram, BENCH_ORG };
+
+   emit(&a, 0x78);  // sei
+
+   if (strcmp(name, "idle") == 0) {
+      poke(&a, 0xd011, 0x0b);
+      poke(&a, 0xd020, 0x00);
+   } else if (strcmp(name, "text") == 0) {
+      textData(m);
+      textMode(&a);
+   } else if (strcmp(name, "sprites") == 0) {
+      textData(m);
+      textMode(&a);
+      sprites(m, &a);
+   } else if (strncmp(name, "hires", 5) == 0 && name[5] >= '0' &&
+                 name[5] <= '4' && name[6] == '\0') {
+      textData(m);
+      textMode(&a);
+      hiresMode(&a, name[5] - '0');
+   } else if (strcmp(name, "dma") == 0) {
+      textMode(&a);
+      hiresMode(&a, 2);
+      dma(&a);
+   } else if (strcmp(name, "blit") == 0) {
+      textMode(&a);
+      hiresMode(&a, 2);
+      blit(&a);
+   } else {
+      LOG(LOG_ERROR, "no bench scenario %s", name);
+      return 1;
+   }
+
+   // The busy ones loop above, the rest just idle here
+   unsigned short loop = a.pc;
+   jmp(&a, loop);
+
+   cpu_init(&m->cpu, BENCH_ORG);
+   LOG(LOG_INFO, "bench scenario %s at $%04x-$%04x", name, BENCH_ORG, a.pc);
+   return 0;
+}
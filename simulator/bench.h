@@ -0,0 +1,44 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_BENCH_H
+#define VICII_BENCH_H
+
+#include "c64.h"
+
+// Canned workloads for the built in 6510 (-M) so simulator speed can be
+// compared across commits without VICE, ROMs or test programs.  Each
+// one is a small program put together here that sets the VIC up and
+// keeps it busy the same way every frame:
+//
+//    idle     border only (display off)
+//    text     40 column text, badlines every 8th line
+//    sprites  text plus all 8 sprites multiplexed down the screen
+//    hires<n> text plus extension hires mode n (0-4)
+//    dma      hires mode 2 with video memory fills and copies
+//    blit     hires mode 2 with an XOR blit every pass
+//
+// The hires, dma and blit ones need a model with those extensions (the
+// superset model) and rely on the simulator activating the extra
+// registers at reset.
+
+extern const char* bench_scenarios[];
+
+// Put scenario name in memory and point the CPU at it. Returns 1 if
+// there is no such scenario.
+int bench_load(struct c64* m, const char* name);
+
+#endif
@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# Run every canned scenario (vicsim -M) on each chip model and report
+# frames per second and model evals per frame.  Results are also kept
+# in bench_results/<commit>.txt so runs can be compared later:
+#
+# usage: bench.sh [-f frames] [-s "scenarios"] [vtop]
+#        bench.sh -c old.txt new.txt
+#
+# Frames/s depends on the machine, evals per frame only on the design.
+# Compare runs from the same machine.
+#
+# The counts come from -j, so every tick and eval is also timed (two
+# TSC reads each).  That overhead is in every fps figure here, so
+# compare bench results with each other, not with runs without -j.
+
+FRAMES=5
+SCENARIOS="idle text sprites hires0 hires1 hires2 hires3 hires4 dma blit"
+CHIPS="0 1 2 3"
+
+if [ "$1" = "-c" ]
+then
+   # Same scenario and chip side by side, fps change in percent
+   join <(awk '!/^#/ { print $1 "/" $2, $4, $5 }' "$2" | sort) \
+        <(awk '!/^#/ { print $1 "/" $2, $4, $5 }' "$3" | sort) |
+   awk 'BEGIN { printf "%-16s %10s %10s %8s %10s %10s\n",
+                "scenario/chip", "fps", "fps", "change", "evals/f", "evals/f" }
+        { printf "%-16s %10.3f %10.3f %7.1f%% %10d %10d\n",
+                $1, $2, $4, ($2 > 0 ? 100 * ($4 - $2) / $2 : 0), $3, $5 }'
+   exit 0
+fi
+
+while getopts "f:s:" opt
+do
+   case $opt in
+      f) FRAMES=$OPTARG ;;
+      s) SCENARIOS=$OPTARG ;;
+      *) exit 1 ;;
+   esac
+done
+shift $((OPTIND - 1))
+VTOP=${1:-obj_dir_super/Vtop}
+
+COMMIT=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+git diff --quiet HEAD 2>/dev/null || COMMIT=$COMMIT-dirty
+mkdir -p bench_results
+OUT=bench_results/$COMMIT.txt
+JSON=$(mktemp)
+
+echo "# $COMMIT $(date +%F) $VTOP frames=$FRAMES" > $OUT
+echo "# scenario chip frames fps evals_per_frame" >> $OUT
+
+for s in $SCENARIOS
+do
+   for chip in $CHIPS
+   do
+      $VTOP -M $s -c $chip -n $FRAMES -l 0 -j $JSON > /dev/null || exit 1
+      frames=$(sed -n 's/.*"frames": \([0-9]*\).*/\1/p' $JSON)
+      evals=$(sed -n 's/.*"evals": \([0-9]*\).*/\1/p' $JSON)
+      fps=$(sed -n 's/.*"frames_per_sec": \([0-9.]*\).*/\1/p' $JSON)
+      echo "$s $chip $frames $fps $((frames > 0 ? evals / frames : 0))" >> $OUT
+   done
+done
+rm -f $JSON
+
+grep -v "^#" $OUT | column -t
+echo "results in $OUT"
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Build the multi-threaded simulator for 1, 2, 4 and 8 threads and
+# report simulated frames per second for each chip model.
+#
+# usage: bench_threads.sh [frames] [config]
+
+FRAMES=${1:-5}
+CONFIG=${2:-0}
+
+for t in 1 2 4 8
+do
+   make mt THREADS=$t SIM_CONFIG=$CONFIG > /dev/null || exit 1
+done
+
+for chip in 0 1 2 3
+do
+   for t in 1 2 4 8
+   do
+      obj_dir_mt$t/Vtop -c $chip -B -n $FRAMES -l 0
+   done
+done
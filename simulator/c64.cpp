@@ -0,0 +1,396 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c64.h"
+#include "log.h"
+
+// $01 bits
+#define PORT_LORAM  1
+#define PORT_HIRAM  2
+#define PORT_CHAREN 4
+
+// CIA registers
+#define CIA_PRA  0x0
+#define CIA_PRB  0x1
+#define CIA_DDRA 0x2
+#define CIA_DDRB 0x3
+#define CIA_TALO 0x4
+#define CIA_TAHI 0x5
+#define CIA_TBLO 0x6
+#define CIA_TBHI 0x7
+#define CIA_ICR  0xd
+#define CIA_CRA  0xe
+#define CIA_CRB  0xf
+
+#define CIA_CR_START   0x01
+#define CIA_CR_ONESHOT 0x08
+#define CIA_CR_LOAD    0x10
+
+// Timer A counts for the kernal's 60Hz jiffy irq
+#define JIFFY_PAL  0x4025
+#define JIFFY_NTSC 0x4295
+
+// Tried in order. The second are the names newer VICE releases use.
+static const char* basicNames[] = { "basic", "basic-901226-01.bin", NULL };
+static const char* kernalNames[] = { "kernal", "kernal-901227-03.bin", NULL };
+static const char* chargenNames[] = { "chargen", "chargen-901225-01.bin", NULL };
+
+// Return 1 if none of the names could be loaded
+static int load_rom(const char* dir, const char** names,
+                    unsigned char* dst, size_t size) {
+   char filename[256];
+   for (int i = 0; names[i]; i++) {
+      snprintf(filename, sizeof(filename), "%s/%s", dir, names[i]);
+      FILE* fp = fopen(filename, "rb");
+      if (fp == NULL)
+         continue;
+      size_t n = fread(dst, 1, size, fp);
+      fclose(fp);
+      if (n == size)
+         return 0;
+      LOG(LOG_ERROR, "%s is not %d bytes", filename, (int) size);
+   }
+   LOG(LOG_WARN, "no %s rom in %s", names[0], dir);
+   return 1;
+}
+
+// ---------------------------------------------------------------- CIA
+
+static void cia_update_irq(struct cia* t) {
+   t->irq = (t->icr & t->imask) != 0;
+}
+
+static unsigned char cia_read(struct cia* t, int reg) {
+   unsigned char v;
+   switch (reg) {
+      // Nothing is connected. Inputs float high.
+      case CIA_PRA: return t->pra | ~t->ddra;
+      case CIA_PRB: return t->prb | ~t->ddrb;
+      case CIA_DDRA: return t->ddra;
+      case CIA_DDRB: return t->ddrb;
+      case CIA_TALO: return t->ta & 0xff;
+      case CIA_TAHI: return t->ta >> 8;
+      case CIA_TBLO: return t->tb & 0xff;
+      case CIA_TBHI: return t->tb >> 8;
+      case CIA_ICR:
+         // Reading acknowledges
+         v = t->icr | (t->irq ? 0x80 : 0);
+         t->icr = 0;
+         cia_update_irq(t);
+         return v;
+      case CIA_CRA: return t->cra;
+      case CIA_CRB: return t->crb;
+      default: return 0;
+   }
+}
+
+static void cia_write(struct cia* t, int reg, unsigned char v) {
+   switch (reg) {
+      case CIA_PRA: t->pra = v; break;
+      case CIA_PRB: t->prb = v; break;
+      case CIA_DDRA: t->ddra = v; break;
+      case CIA_DDRB: t->ddrb = v; break;
+      case CIA_TALO: t->ta_latch = (t->ta_latch & 0xff00) | v; break;
+      case CIA_TAHI:
+         t->ta_latch = (t->ta_latch & 0x00ff) | (v << 8);
+         if (!(t->cra & CIA_CR_START))
+            t->ta = t->ta_latch;
+         break;
+      case CIA_TBLO: t->tb_latch = (t->tb_latch & 0xff00) | v; break;
+      case CIA_TBHI:
+         t->tb_latch = (t->tb_latch & 0x00ff) | (v << 8);
+         if (!(t->crb & CIA_CR_START))
+            t->tb = t->tb_latch;
+         break;
+      case CIA_ICR:
+         if (v & 0x80)
+            t->imask |= v & 0x1f;
+         else
+            t->imask &= ~v;
+         cia_update_irq(t);
+         break;
+      case CIA_CRA:
+         if (v & CIA_CR_LOAD)
+            t->ta = t->ta_latch;
+         t->cra = v & ~CIA_CR_LOAD;
+         break;
+      case CIA_CRB:
+         if (v & CIA_CR_LOAD)
+            t->tb = t->tb_latch;
+         t->crb = v & ~CIA_CR_LOAD;
+         break;
+      default:
+         break;
+   }
+}
+
+// One phi2 cycle. Timer B counts either cycles or timer A underflows.
+static void cia_clock(struct cia* t) {
+   int underflowA = 0;
+   if (t->cra & CIA_CR_START) {
+      if (t->ta == 0) {
+         underflowA = 1;
+         t->icr |= 1;
+         t->ta = t->ta_latch;
+         if (t->cra & CIA_CR_ONESHOT)
+            t->cra &= ~CIA_CR_START;
+      } else {
+         t->ta--;
+      }
+   }
+
+   int countB = (t->crb & 0x60) == 0 ? 1 : ((t->crb & 0x60) == 0x40 && underflowA);
+   if ((t->crb & CIA_CR_START) && countB) {
+      if (t->tb == 0) {
+         t->icr |= 2;
+         t->tb = t->tb_latch;
+         if (t->crb & CIA_CR_ONESHOT)
+            t->crb &= ~CIA_CR_START;
+      } else {
+         t->tb--;
+      }
+   }
+   cia_update_irq(t);
+}
+
+// --------------------------------------------------------- memory map
+
+static unsigned char port_value(struct c64* m) {
+   // Inputs are pulled up
+   return (m->portData & m->portDdr) | (~m->portDdr & 0xff);
+}
+
+static int io_visible(struct c64* m) {
+   unsigned char port = port_value(m);
+   return (port & (PORT_LORAM | PORT_HIRAM)) && (port & PORT_CHAREN);
+}
+
+static unsigned char cpu_read(struct c64* m, unsigned short addr) {
+   unsigned char port = port_value(m);
+
+   if (addr == 0)
+      return m->portDdr;
+   if (addr == 1)
+      return port;
+
+   if (addr >= 0xa000 && addr < 0xc000) {
+      if (m->haveBasic && (port & (PORT_LORAM | PORT_HIRAM)) ==
+             (PORT_LORAM | PORT_HIRAM))
+         return m->basic[addr - 0xa000];
+   } else if (addr >= 0xe000) {
+      if (m->haveKernal && (port & PORT_HIRAM))
+         return m->kernal[addr - 0xe000];
+   } else if (addr >= 0xd000 && addr < 0xe000 &&
+                 (port & (PORT_LORAM | PORT_HIRAM))) {
+      if (!(port & PORT_CHAREN))
+         return m->haveChargen ? m->chargen[addr - 0xd000] : m->ram[addr];
+      if (addr >= 0xd800 && addr < 0xdc00)
+         return (m->phi1Data & 0xf0) | m->color[addr - 0xd800];
+      if (addr >= 0xdc00 && addr < 0xdd00)
+         return cia_read(&m->cia1, addr & 0xf);
+      if (addr >= 0xdd00 && addr < 0xde00)
+         return cia_read(&m->cia2, addr & 0xf);
+      // SID and the expansion area
+      return m->phi1Data;
+   }
+   return m->ram[addr];
+}
+
+static void cpu_write(struct c64* m, unsigned short addr, unsigned char v) {
+   if (addr == 0)
+      m->portDdr = v;
+   else if (addr == 1)
+      m->portData = v;
+
+   if (addr >= 0xd000 && addr < 0xe000 && io_visible(m)) {
+      if (addr >= 0xd800 && addr < 0xdc00)
+         m->color[addr - 0xd800] = v & 0x0f;
+      else if (addr >= 0xdc00 && addr < 0xdd00)
+         cia_write(&m->cia1, addr & 0xf, v);
+      else if (addr >= 0xdd00 && addr < 0xde00)
+         cia_write(&m->cia2, addr & 0xf, v);
+      return;
+   }
+
+   // Writes under the ROMs land in RAM
+   m->ram[addr] = v;
+}
+
+// ---------------------------------------------------------------- API
+
+// What the kernal would have done by the time BASIC is ready
+static void kernal_boot(struct c64* m, int isNtsc) {
+   // RESTOR copies the vector table to $0314
+   memcpy(&m->ram[0x0314], &m->kernal[0xfd30 - 0xe000], 32);
+
+   // Keyboard table and decode vectors used by the irq handler
+   m->ram[0x028f] = 0x48;
+   m->ram[0x0290] = 0xeb;
+   m->ram[0x00f5] = 0x81;
+   m->ram[0x00f6] = 0xeb;
+   // No cursor blink
+   m->ram[0x00cc] = 1;
+   m->ram[0x0288] = 0x04;
+
+   m->cia1.ddra = 0xff;
+   m->cia1.pra = 0x7f;
+   m->cia1.ta_latch = isNtsc ? JIFFY_NTSC : JIFFY_PAL;
+   m->cia1.ta = m->cia1.ta_latch;
+   m->cia1.cra = CIA_CR_START;
+   m->cia1.imask = 1;
+}
+
+struct c64* c64_init(const char* romDir, int isNtsc) {
+   struct c64* m = (struct c64*) calloc(1, sizeof(struct c64));
+
+   if (romDir) {
+      m->haveBasic = !load_rom(romDir, basicNames, m->basic, sizeof(m->basic));
+      m->haveKernal = !load_rom(romDir, kernalNames, m->kernal, sizeof(m->kernal));
+      m->haveChargen = !load_rom(romDir, chargenNames, m->chargen, sizeof(m->chargen));
+   }
+
+   m->portDdr = 0x2f;
+   m->portData = 0x37;
+
+   // Bank 0
+   m->cia2.ddra = 0x3f;
+   m->cia2.pra = 0x07;
+
+   // Blank screen, light blue text
+   memset(&m->ram[0x0400], 0x20, 1000);
+   memset(m->color, 14, sizeof(m->color));
+
+   if (m->haveKernal)
+      kernal_boot(m, isNtsc);
+
+   cpu_init(&m->cpu, 0);
+   return m;
+}
+
+void c64_free(struct c64* m) {
+   free(m);
+}
+
+// Address in the first line of a BASIC stub like 10 SYS 2061, or 0
+static unsigned short sys_address(struct c64* m) {
+   // Skip the link and line number
+   unsigned short p = 0x0801 + 4;
+   while (p < 0x0900 && m->ram[p] != 0 && m->ram[p] != 0x9e)
+      p++;
+   if (m->ram[p] != 0x9e)
+      return 0;
+   p++;
+
+   unsigned int addr = 0;
+   while (m->ram[p] == ' ' || m->ram[p] == '(')
+      p++;
+   while (m->ram[p] >= '0' && m->ram[p] <= '9')
+      addr = addr * 10 + (m->ram[p++] - '0');
+   return addr > 0xffff ? 0 : addr;
+}
+
+int c64_load_prg(struct c64* m, const char* filename) {
+   FILE* fp = fopen(filename, "rb");
+   if (fp == NULL) {
+      LOG(LOG_ERROR, "can't open %s", filename);
+      return 1;
+   }
+
+   unsigned char hdr[2];
+   if (fread(hdr, 1, 2, fp) != 2) {
+      LOG(LOG_ERROR, "%s is too short", filename);
+      fclose(fp);
+      return 1;
+   }
+   unsigned short start = hdr[0] | (hdr[1] << 8);
+   size_t n = fread(&m->ram[start], 1, 0x10000 - start, fp);
+   fclose(fp);
+
+   // End of program for BASIC (VARTAB) and the loader (EAL)
+   unsigned short end = start + n;
+   m->ram[0x2d] = m->ram[0xae] = end & 0xff;
+   m->ram[0x2e] = m->ram[0xaf] = end >> 8;
+
+   unsigned short pc = start;
+   if (start == 0x0801) {
+      pc = sys_address(m);
+      if (pc == 0) {
+         LOG(LOG_ERROR, "%s has no SYS line to start from", filename);
+         return 1;
+      }
+   }
+
+   // As if called from BASIC's RUN with interrupts on
+   cpu_init(&m->cpu, pc);
+   m->cpu.s = 0xf6;
+   m->cpu.p &= ~CPU_FLAG_I;
+   LOG(LOG_INFO, "loaded %s at $%04x-$%04x, starting at $%04x",
+       filename, start, end, pc);
+   return 0;
+}
+
+int c64_cpu_begin(struct c64* m, int aec, int ba) {
+   struct cpu6510* c = &m->cpu;
+
+   // The VIC owns phi high, or has asked for it and we're reading
+   // (RDY only stops the 6510 on reads).
+   if (!aec || (!ba && c->rw))
+      return C64_BUS_NONE;
+
+   if (c->addr >= 0xd000 && c->addr < 0xd400 && io_visible(m))
+      return C64_BUS_VIC;
+
+   if (c->rw)
+      c->data = cpu_read(m, c->addr);
+   else
+      cpu_write(m, c->addr, c->data);
+   return C64_BUS_MEM;
+}
+
+void c64_cpu_end(struct c64* m, int bus, unsigned char vicData, int vicIrq) {
+   struct cpu6510* c = &m->cpu;
+
+   cia_clock(&m->cia1);
+   cia_clock(&m->cia2);
+
+   c->irq = vicIrq || m->cia1.irq;
+   c->nmi = m->cia2.irq;
+
+   if (bus == C64_BUS_NONE)
+      return;
+   if (bus == C64_BUS_VIC && c->rw)
+      c->data = vicData;
+   cpu_tick(c);
+}
+
+unsigned short c64_vic_fetch(struct c64* m, unsigned short vicAddr) {
+   unsigned int bank = 3 - ((m->cia2.pra | ~m->cia2.ddra) & 3);
+   unsigned short addr = (bank << 14) | (vicAddr & 0x3fff);
+   unsigned char data;
+
+   // The char ROM shows up at $1000-$1fff in banks 0 and 2
+   if ((bank & 1) == 0 && (vicAddr & 0x3000) == 0x1000 && m->haveChargen)
+      data = m->chargen[vicAddr & 0x0fff];
+   else
+      data = m->ram[addr];
+
+   m->phi1Data = data;
+   return data | (m->color[vicAddr & 0x3ff] << 8);
+}
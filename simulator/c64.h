@@ -0,0 +1,98 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_C64_H
+#define VICII_C64_H
+
+#include "cpu6510.h"
+
+// Enough of a C64 around the VIC to run programs without VICE.
+//
+// A 6510, 64K of RAM, color RAM, the ROMs (if we have them) and a pair
+// of CIAs with just their timers and interrupts.  There is no SID,
+// keyboard or disk.  The simulator drives the VIC's bus from here: the
+// CPU gets the phi high half of each cycle (see c64_cpu_begin) and the
+// VIC's own fetches are served by c64_vic_fetch.
+//
+// Nothing here knows about the model so it can be driven from anything
+// that produces phi, aec, ba and irq.
+
+// What the CPU is doing with the bus this cycle
+#define C64_BUS_NONE 0  // stalled or the VIC has the bus
+#define C64_BUS_MEM  1  // memory or other I/O, already done
+#define C64_BUS_VIC  2  // VIC register, caller must drive the VIC
+
+struct cia {
+   unsigned char pra;
+   unsigned char prb;
+   unsigned char ddra;
+   unsigned char ddrb;
+   unsigned short ta;
+   unsigned short tb;
+   unsigned short ta_latch;
+   unsigned short tb_latch;
+   unsigned char cra;
+   unsigned char crb;
+   unsigned char icr;   // interrupt sources that fired
+   unsigned char imask; // enabled interrupt sources
+   int irq;
+};
+
+struct c64 {
+   unsigned char ram[65536];
+   unsigned char color[1024];
+   unsigned char basic[8192];
+   unsigned char kernal[8192];
+   unsigned char chargen[4096];
+   int haveBasic;
+   int haveKernal;
+   int haveChargen;
+
+   // 6510 I/O port at $00/$01
+   unsigned char portDdr;
+   unsigned char portData;
+
+   struct cia cia1; // irq
+   struct cia cia2; // nmi, VIC bank
+
+   struct cpu6510 cpu;
+
+   // Last thing the VIC read in phi low, seen on unconnected reads
+   unsigned char phi1Data;
+};
+
+// Load basic, kernal and chargen from romDir if given.  With a kernal
+// the machine is set up as it would be after boot (vectors, CIA timer
+// irq) so programs that rely on it work.  Return NULL on error
+struct c64* c64_init(const char* romDir, int isNtsc);
+
+void c64_free(struct c64* m);
+
+// Load a .prg and point the CPU at it.  BASIC programs starting with
+// SYS <addr> start at addr.  Return 1 on error, 0 success
+int c64_load_prg(struct c64* m, const char* filename);
+
+// Start of phi high.  Returns one of C64_BUS_*. For C64_BUS_VIC the
+// access is in cpu.addr, cpu.rw and cpu.data.
+int c64_cpu_begin(struct c64* m, int aec, int ba);
+
+// End of the cycle. vicData is what the VIC drove for a register read.
+void c64_cpu_end(struct c64* m, int bus, unsigned char vicData, int vicIrq);
+
+// What the VIC sees at its 14 bit address. Color RAM is in bits 8-11.
+unsigned short c64_vic_fetch(struct c64* m, unsigned short vicAddr);
+
+#endif
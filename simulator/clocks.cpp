@@ -0,0 +1,59 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+
+#include "clocks.h"
+#include "log.h"
+
+void clocks_init(struct sim_clocks* clocks) {
+   clocks->num = 0;
+}
+
+struct sim_clock* clocks_add(struct sim_clocks* clocks, CData* signal,
+                             vluint64_t half_period, unsigned int gate) {
+   if (clocks->num == MAX_CLOCKS) {
+      LOG(LOG_ERROR, "too many clocks");
+      exit(-1);
+   }
+
+   struct sim_clock* clk = &clocks->clk[clocks->num++];
+   clk->signal = signal;
+   clk->half_period = half_period;
+   clk->next_edge = half_period;
+   clk->gate = gate;
+   clk->step = 0;
+   return clk;
+}
+
+vluint64_t clocks_advance(struct sim_clocks* clocks) {
+   vluint64_t t = clocks->clk[0].next_edge;
+   for (int i = 1; i < clocks->num; i++) {
+      if (clocks->clk[i].next_edge < t)
+         t = clocks->clk[i].next_edge;
+   }
+
+   for (int i = 0; i < clocks->num; i++) {
+      struct sim_clock* clk = &clocks->clk[i];
+      if (clk->next_edge == t) {
+         if (clk->gate & (1 << clk->step))
+            *clk->signal ^= 1;
+         clk->step = (clk->step + 1) & 15;
+         clk->next_edge += clk->half_period;
+      }
+   }
+   return t;
+}
@@ -0,0 +1,77 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_CLOCKS_H
+#define VICII_CLOCKS_H
+
+#include <verilated.h>
+
+// Multi-clock edge scheduler for the simulator.
+//
+// Every clock input of the model is described by an exact half period
+// in picoseconds and the absolute time of its next edge.  Advancing
+// the scheduler finds the earliest pending edge and toggles every
+// clock that has an edge at that time, so coincident edges cost a
+// single eval().  Only integer math is involved so clocks never drift
+// relative to each other no matter how long we run.
+//
+// A clock can optionally be gated by a 16 step mask.  The clock takes
+// a step on each of its edges but only toggles when the step's bit is
+// set.  This is how a clock that runs at a fraction of another one
+// (i.e. clk_dvi from clk_dot4x) is produced.
+
+#define MAX_CLOCKS 8
+
+// col16x only feeds the luma/chroma generator (comp_sync.v) and the
+// cas/ras pad shaping in addressgen.v.  Configurations without
+// GEN_LUMA_CHROMA leave it out of the clock set, which saves two or
+// three evals per dot4x edge.  The cas/ras pads then only get their
+// dot4x edges; build with -DSIM_WITH_COL16X if their exact shape
+// matters.
+#if defined(GEN_LUMA_CHROMA) || defined(SIM_WITH_COL16X)
+#define HAVE_COL16X 1
+#else
+#define HAVE_COL16X 0
+#endif
+
+// Toggle on every edge
+#define CLOCK_GATE_ALL 0xffff
+
+struct sim_clock {
+   CData* signal;
+   vluint64_t half_period;
+   vluint64_t next_edge;
+   unsigned int gate;
+   int step;
+};
+
+struct sim_clocks {
+   int num;
+   struct sim_clock clk[MAX_CLOCKS];
+};
+
+void clocks_init(struct sim_clocks* clocks);
+
+// Add a clock driving signal. Its first edge happens one half period
+// from time 0.  Returns the clock.
+struct sim_clock* clocks_add(struct sim_clocks* clocks, CData* signal,
+                             vluint64_t half_period, unsigned int gate);
+
+// Toggle all clocks with an edge at the earliest pending time and
+// return that time.
+vluint64_t clocks_advance(struct sim_clocks* clocks);
+
+#endif
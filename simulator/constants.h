@@ -30,17 +30,29 @@
 
 #define BORDER_DELAY 2
 
+// sim_features bits of a superset model (gen_config 11), must match
+// FEATURE_* in common.vh
+#define FEATURE_EXTENSIONS 0x1
+#define FEATURE_MATH       0x2
+#define FEATURE_HIRES      0x4
+#define FEATURE_BLITTER    0x8
+#define FEATURE_ALL        0xf
+
+// The dot4x and col16x half periods are rounded to multiples of a
+// common unit so their ratio is exact (7/4 for NTSC, 9/4 for PAL)
+// and the clock scheduler never drifts one against the other.
+
 // Dot 8.1818181
 // Color 3.579545
-#define NTSC_HALF_4X_DOT_PS 15277   // half the period of 32.727272Mhz
+#define NTSC_HALF_4X_DOT_PS 15281   // half the period of 32.727272Mhz (7 * 2183)
 #define NTSC_HALF_4X_COLOR_PS 34921 // half the period of 14.318181Mhz
-#define NTSC_HALF_16X_COLOR_PS 8730 // half the period of col16x
+#define NTSC_HALF_16X_COLOR_PS 8732 // half the period of col16x (4 * 2183)
 
 // Dot 7.8819888
 // Color 4.43361875
-#define PAL_HALF_4X_DOT_PS 15859   // half the period of 31.527955Mhz
+#define PAL_HALF_4X_DOT_PS 15858   // half the period of 31.527955Mhz (9 * 1762)
 #define PAL_HALF_4X_COLOR_PS 28194 // half the period of 17.734475Mhz
-#define PAL_HALF_16X_COLOR_PS 7048 // half the period of col16x
+#define PAL_HALF_16X_COLOR_PS 7048 // half the period of col16x (4 * 1762)
 
 // Must match fpga design being simulated
 #define NTSC_6567R56A_NUM_CYCLES 64
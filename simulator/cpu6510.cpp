@@ -0,0 +1,714 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include "cpu6510.h"
+
+// Addressing modes. The ones after M_REL are opcodes with their own
+// sequence of bus cycles.
+enum {
+   M_IMP, M_ACC, M_IMM, M_ZP, M_ZPX, M_ZPY, M_ABS, M_ABX, M_ABY,
+   M_IZX, M_IZY, M_REL,
+   M_BRK, M_JSR, M_RTS, M_RTI, M_PSH, M_PUL, M_JMP, M_JMI, M_JAM
+};
+
+enum {
+   OP_ADC, OP_ALR, OP_ANC, OP_AND, OP_ANE, OP_ARR, OP_ASL, OP_BCC, OP_BCS,
+   OP_BEQ, OP_BIT, OP_BMI, OP_BNE, OP_BPL, OP_BRK, OP_BVC, OP_BVS, OP_CLC,
+   OP_CLD, OP_CLI, OP_CLV, OP_CMP, OP_CPX, OP_CPY, OP_DCP, OP_DEC, OP_DEX,
+   OP_DEY, OP_EOR, OP_INC, OP_INX, OP_INY, OP_ISC, OP_JAM, OP_JMP, OP_JSR,
+   OP_LAS, OP_LAX, OP_LDA, OP_LDX, OP_LDY, OP_LSR, OP_LXA, OP_NOP, OP_ORA,
+   OP_PHA, OP_PHP, OP_PLA, OP_PLP, OP_RLA, OP_ROL, OP_ROR, OP_RRA, OP_RTI,
+   OP_RTS, OP_SAX, OP_SBC, OP_SBX, OP_SEC, OP_SED, OP_SEI, OP_SHA, OP_SHX,
+   OP_SHY, OP_SLO, OP_SRE, OP_STA, OP_STX, OP_STY, OP_TAS, OP_TAX, OP_TAY,
+   OP_TSX, OP_TXA, OP_TXS, OP_TYA
+};
+
+// How an opcode uses its effective address
+enum { K_READ, K_WRITE, K_RMW };
+
+static const unsigned char op_table[256] = {
+   OP_BRK, OP_ORA, OP_JAM, OP_SLO, OP_NOP, OP_ORA, OP_ASL, OP_SLO, // 00
+   OP_PHP, OP_ORA, OP_ASL, OP_ANC, OP_NOP, OP_ORA, OP_ASL, OP_SLO, // 08
+   OP_BPL, OP_ORA, OP_JAM, OP_SLO, OP_NOP, OP_ORA, OP_ASL, OP_SLO, // 10
+   OP_CLC, OP_ORA, OP_NOP, OP_SLO, OP_NOP, OP_ORA, OP_ASL, OP_SLO, // 18
+   OP_JSR, OP_AND, OP_JAM, OP_RLA, OP_BIT, OP_AND, OP_ROL, OP_RLA, // 20
+   OP_PLP, OP_AND, OP_ROL, OP_ANC, OP_BIT, OP_AND, OP_ROL, OP_RLA, // 28
+   OP_BMI, OP_AND, OP_JAM, OP_RLA, OP_NOP, OP_AND, OP_ROL, OP_RLA, // 30
+   OP_SEC, OP_AND, OP_NOP, OP_RLA, OP_NOP, OP_AND, OP_ROL, OP_RLA, // 38
+   OP_RTI, OP_EOR, OP_JAM, OP_SRE, OP_NOP, OP_EOR, OP_LSR, OP_SRE, // 40
+   OP_PHA, OP_EOR, OP_LSR, OP_ALR, OP_JMP, OP_EOR, OP_LSR, OP_SRE, // 48
+   OP_BVC, OP_EOR, OP_JAM, OP_SRE, OP_NOP, OP_EOR, OP_LSR, OP_SRE, // 50
+   OP_CLI, OP_EOR, OP_NOP, OP_SRE, OP_NOP, OP_EOR, OP_LSR, OP_SRE, // 58
+   OP_RTS, OP_ADC, OP_JAM, OP_RRA, OP_NOP, OP_ADC, OP_ROR, OP_RRA, // 60
+   OP_PLA, OP_ADC, OP_ROR, OP_ARR, OP_JMP, OP_ADC, OP_ROR, OP_RRA, // 68
+   OP_BVS, OP_ADC, OP_JAM, OP_RRA, OP_NOP, OP_ADC, OP_ROR, OP_RRA, // 70
+   OP_SEI, OP_ADC, OP_NOP, OP_RRA, OP_NOP, OP_ADC, OP_ROR, OP_RRA, // 78
+   OP_NOP, OP_STA, OP_NOP, OP_SAX, OP_STY, OP_STA, OP_STX, OP_SAX, // 80
+   OP_DEY, OP_NOP, OP_TXA, OP_ANE, OP_STY, OP_STA, OP_STX, OP_SAX, // 88
+   OP_BCC, OP_STA, OP_JAM, OP_SHA, OP_STY, OP_STA, OP_STX, OP_SAX, // 90
+   OP_TYA, OP_STA, OP_TXS, OP_TAS, OP_SHY, OP_STA, OP_SHX, OP_SHA, // 98
+   OP_LDY, OP_LDA, OP_LDX, OP_LAX, OP_LDY, OP_LDA, OP_LDX, OP_LAX, // a0
+   OP_TAY, OP_LDA, OP_TAX, OP_LXA, OP_LDY, OP_LDA, OP_LDX, OP_LAX, // a8
+   OP_BCS, OP_LDA, OP_JAM, OP_LAX, OP_LDY, OP_LDA, OP_LDX, OP_LAX, // b0
+   OP_CLV, OP_LDA, OP_TSX, OP_LAS, OP_LDY, OP_LDA, OP_LDX, OP_LAX, // b8
+   OP_CPY, OP_CMP, OP_NOP, OP_DCP, OP_CPY, OP_CMP, OP_DEC, OP_DCP, // c0
+   OP_INY, OP_CMP, OP_DEX, OP_SBX, OP_CPY, OP_CMP, OP_DEC, OP_DCP, // c8
+   OP_BNE, OP_CMP, OP_JAM, OP_DCP, OP_NOP, OP_CMP, OP_DEC, OP_DCP, // d0
+   OP_CLD, OP_CMP, OP_NOP, OP_DCP, OP_NOP, OP_CMP, OP_DEC, OP_DCP, // d8
+   OP_CPX, OP_SBC, OP_NOP, OP_ISC, OP_CPX, OP_SBC, OP_INC, OP_ISC, // e0
+   OP_INX, OP_SBC, OP_NOP, OP_SBC, OP_CPX, OP_SBC, OP_INC, OP_ISC, // e8
+   OP_BEQ, OP_SBC, OP_JAM, OP_ISC, OP_NOP, OP_SBC, OP_INC, OP_ISC, // f0
+   OP_SED, OP_SBC, OP_NOP, OP_ISC, OP_NOP, OP_SBC, OP_INC, OP_ISC, // f8
+};
+
+static const unsigned char mode_table[256] = {
+   M_BRK, M_IZX, M_JAM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // 00
+   M_PSH, M_IMM, M_ACC, M_IMM, M_ABS, M_ABS, M_ABS, M_ABS, // 08
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPX, M_ZPX, // 10
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABX, M_ABX, // 18
+   M_JSR, M_IZX, M_JAM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // 20
+   M_PUL, M_IMM, M_ACC, M_IMM, M_ABS, M_ABS, M_ABS, M_ABS, // 28
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPX, M_ZPX, // 30
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABX, M_ABX, // 38
+   M_RTI, M_IZX, M_JAM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // 40
+   M_PSH, M_IMM, M_ACC, M_IMM, M_JMP, M_ABS, M_ABS, M_ABS, // 48
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPX, M_ZPX, // 50
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABX, M_ABX, // 58
+   M_RTS, M_IZX, M_JAM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // 60
+   M_PUL, M_IMM, M_ACC, M_IMM, M_JMI, M_ABS, M_ABS, M_ABS, // 68
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPX, M_ZPX, // 70
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABX, M_ABX, // 78
+   M_IMM, M_IZX, M_IMM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // 80
+   M_IMP, M_IMM, M_IMP, M_IMM, M_ABS, M_ABS, M_ABS, M_ABS, // 88
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPY, M_ZPY, // 90
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABY, M_ABY, // 98
+   M_IMM, M_IZX, M_IMM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // a0
+   M_IMP, M_IMM, M_IMP, M_IMM, M_ABS, M_ABS, M_ABS, M_ABS, // a8
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPY, M_ZPY, // b0
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABY, M_ABY, // b8
+   M_IMM, M_IZX, M_IMM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // c0
+   M_IMP, M_IMM, M_IMP, M_IMM, M_ABS, M_ABS, M_ABS, M_ABS, // c8
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPX, M_ZPX, // d0
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABX, M_ABX, // d8
+   M_IMM, M_IZX, M_IMM, M_IZX, M_ZP, M_ZP, M_ZP, M_ZP, // e0
+   M_IMP, M_IMM, M_IMP, M_IMM, M_ABS, M_ABS, M_ABS, M_ABS, // e8
+   M_REL, M_IZY, M_JAM, M_IZY, M_ZPX, M_ZPX, M_ZPX, M_ZPX, // f0
+   M_IMP, M_ABY, M_IMP, M_ABY, M_ABX, M_ABX, M_ABX, M_ABX, // f8
+};
+
+
+// First step after the effective address is known
+#define MEM_STEP 16
+
+#define RD(c, a) do { (c)->addr = (a); (c)->rw = 1; } while (0)
+#define WR(c, a, v) do { (c)->addr = (a); (c)->data = (v); (c)->rw = 0; } while (0)
+
+static int kind_of(int op) {
+   switch (op) {
+      case OP_STA: case OP_STX: case OP_STY: case OP_SAX:
+      case OP_SHA: case OP_SHX: case OP_SHY: case OP_TAS:
+         return K_WRITE;
+      case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+      case OP_INC: case OP_DEC: case OP_SLO: case OP_RLA:
+      case OP_SRE: case OP_RRA: case OP_DCP: case OP_ISC:
+         return K_RMW;
+      default:
+         return K_READ;
+   }
+}
+
+static void set_nz(struct cpu6510* c, unsigned char v) {
+   c->p = (c->p & ~(CPU_FLAG_N | CPU_FLAG_Z)) | (v & CPU_FLAG_N) |
+      (v ? 0 : CPU_FLAG_Z);
+}
+
+static void set_flag(struct cpu6510* c, unsigned char flag, int on) {
+   if (on)
+      c->p |= flag;
+   else
+      c->p &= ~flag;
+}
+
+static void adc(struct cpu6510* c, unsigned char v) {
+   unsigned int carry = c->p & CPU_FLAG_C;
+   unsigned int sum = c->a + v + carry;
+
+   if (c->p & CPU_FLAG_D) {
+      // NMOS decimal mode. Z comes from the binary sum, N and V from
+      // the intermediate result.
+      unsigned int lo = (c->a & 0x0f) + (v & 0x0f) + carry;
+      unsigned int hi = (c->a >> 4) + (v >> 4);
+      if (lo > 9) {
+         lo += 6;
+         hi++;
+      }
+      set_flag(c, CPU_FLAG_Z, (sum & 0xff) == 0);
+      set_flag(c, CPU_FLAG_N, hi & 0x08);
+      set_flag(c, CPU_FLAG_V, ((hi << 4) ^ c->a) & 0x80 && !((c->a ^ v) & 0x80));
+      if (hi > 9)
+         hi += 6;
+      set_flag(c, CPU_FLAG_C, hi > 0x0f);
+      c->a = (hi << 4) | (lo & 0x0f);
+   } else {
+      set_flag(c, CPU_FLAG_V, ~(c->a ^ v) & (c->a ^ sum) & 0x80);
+      set_flag(c, CPU_FLAG_C, sum > 0xff);
+      c->a = sum;
+      set_nz(c, c->a);
+   }
+}
+
+static void sbc(struct cpu6510* c, unsigned char v) {
+   unsigned int borrow = (c->p & CPU_FLAG_C) ? 0 : 1;
+   unsigned int diff = c->a - v - borrow;
+
+   // Flags always come from the binary result
+   set_flag(c, CPU_FLAG_V, (c->a ^ v) & (c->a ^ diff) & 0x80);
+   set_flag(c, CPU_FLAG_C, diff < 0x100);
+   set_nz(c, diff & 0xff);
+
+   if (c->p & CPU_FLAG_D) {
+      unsigned int lo = (c->a & 0x0f) - (v & 0x0f) - borrow;
+      unsigned int hi = (c->a >> 4) - (v >> 4);
+      if (lo & 0x10) {
+         lo -= 6;
+         hi--;
+      }
+      if (hi & 0x10)
+         hi -= 6;
+      c->a = (hi << 4) | (lo & 0x0f);
+   } else {
+      c->a = diff;
+   }
+}
+
+static void compare(struct cpu6510* c, unsigned char reg, unsigned char v) {
+   set_flag(c, CPU_FLAG_C, reg >= v);
+   set_nz(c, reg - v);
+}
+
+static void arr(struct cpu6510* c, unsigned char v) {
+   unsigned char t = c->a & v;
+   unsigned char carry = c->p & CPU_FLAG_C;
+
+   c->a = (t >> 1) | (carry << 7);
+   if (c->p & CPU_FLAG_D) {
+      set_flag(c, CPU_FLAG_N, carry);
+      set_flag(c, CPU_FLAG_Z, c->a == 0);
+      set_flag(c, CPU_FLAG_V, (t ^ c->a) & 0x40);
+      if ((t & 0x0f) + (t & 0x01) > 5)
+         c->a = (c->a & 0xf0) | ((c->a + 6) & 0x0f);
+      set_flag(c, CPU_FLAG_C, (t & 0xf0) + (t & 0x10) > 0x50);
+      if (c->p & CPU_FLAG_C)
+         c->a += 0x60;
+   } else {
+      set_nz(c, c->a);
+      set_flag(c, CPU_FLAG_C, c->a & 0x40);
+      set_flag(c, CPU_FLAG_V, (c->a & 0x40) ^ ((c->a & 0x20) << 1));
+   }
+}
+
+// Shifts and rotates shared by the accumulator and memory forms
+static unsigned char shift(struct cpu6510* c, int op, unsigned char v) {
+   unsigned char carry = c->p & CPU_FLAG_C;
+   switch (op) {
+      case OP_ASL: case OP_SLO:
+         set_flag(c, CPU_FLAG_C, v & 0x80);
+         v <<= 1;
+         break;
+      case OP_LSR: case OP_SRE:
+         set_flag(c, CPU_FLAG_C, v & 0x01);
+         v >>= 1;
+         break;
+      case OP_ROL: case OP_RLA:
+         set_flag(c, CPU_FLAG_C, v & 0x80);
+         v = (v << 1) | carry;
+         break;
+      case OP_ROR: case OP_RRA:
+         set_flag(c, CPU_FLAG_C, v & 0x01);
+         v = (v >> 1) | (carry << 7);
+         break;
+   }
+   set_nz(c, v);
+   return v;
+}
+
+static void implied(struct cpu6510* c, int op) {
+   switch (op) {
+      case OP_CLC: c->p &= ~CPU_FLAG_C; break;
+      case OP_SEC: c->p |= CPU_FLAG_C; break;
+      case OP_CLI: c->p &= ~CPU_FLAG_I; break;
+      case OP_SEI: c->p |= CPU_FLAG_I; break;
+      case OP_CLV: c->p &= ~CPU_FLAG_V; break;
+      case OP_CLD: c->p &= ~CPU_FLAG_D; break;
+      case OP_SED: c->p |= CPU_FLAG_D; break;
+      case OP_TAX: c->x = c->a; set_nz(c, c->x); break;
+      case OP_TAY: c->y = c->a; set_nz(c, c->y); break;
+      case OP_TXA: c->a = c->x; set_nz(c, c->a); break;
+      case OP_TYA: c->a = c->y; set_nz(c, c->a); break;
+      case OP_TSX: c->x = c->s; set_nz(c, c->x); break;
+      case OP_TXS: c->s = c->x; break;
+      case OP_INX: set_nz(c, ++c->x); break;
+      case OP_INY: set_nz(c, ++c->y); break;
+      case OP_DEX: set_nz(c, --c->x); break;
+      case OP_DEY: set_nz(c, --c->y); break;
+      case OP_ASL: case OP_LSR: case OP_ROL: case OP_ROR:
+         c->a = shift(c, op, c->a);
+         break;
+      default:
+         break;
+   }
+}
+
+static void do_read(struct cpu6510* c, int op, unsigned char v) {
+   switch (op) {
+      case OP_LDA: c->a = v; set_nz(c, v); break;
+      case OP_LDX: c->x = v; set_nz(c, v); break;
+      case OP_LDY: c->y = v; set_nz(c, v); break;
+      case OP_LAX: c->a = c->x = v; set_nz(c, v); break;
+      case OP_AND: c->a &= v; set_nz(c, c->a); break;
+      case OP_ORA: c->a |= v; set_nz(c, c->a); break;
+      case OP_EOR: c->a ^= v; set_nz(c, c->a); break;
+      case OP_ADC: adc(c, v); break;
+      case OP_SBC: sbc(c, v); break;
+      case OP_CMP: compare(c, c->a, v); break;
+      case OP_CPX: compare(c, c->x, v); break;
+      case OP_CPY: compare(c, c->y, v); break;
+      case OP_BIT:
+         set_flag(c, CPU_FLAG_Z, (c->a & v) == 0);
+         c->p = (c->p & ~(CPU_FLAG_N | CPU_FLAG_V)) |
+            (v & (CPU_FLAG_N | CPU_FLAG_V));
+         break;
+      case OP_ANC:
+         c->a &= v;
+         set_nz(c, c->a);
+         set_flag(c, CPU_FLAG_C, c->a & 0x80);
+         break;
+      case OP_ALR:
+         c->a &= v;
+         c->a = shift(c, OP_LSR, c->a);
+         break;
+      case OP_ARR: arr(c, v); break;
+      case OP_SBX: {
+         unsigned char ax = c->a & c->x;
+         set_flag(c, CPU_FLAG_C, ax >= v);
+         c->x = ax - v;
+         set_nz(c, c->x);
+         break;
+      }
+      // Unstable on real chips, these are the usual C64 constants
+      case OP_ANE: c->a = (c->a | 0xef) & c->x & v; set_nz(c, c->a); break;
+      case OP_LXA: c->a = c->x = (c->a | 0xee) & v; set_nz(c, c->a); break;
+      case OP_LAS: c->a = c->x = c->s = c->s & v; set_nz(c, c->a); break;
+      default:
+         break;
+   }
+}
+
+// Value written by a store. The SHx opcodes AND with the high byte of
+// the base address plus one and put the result on the high address
+// lines when indexing crosses a page.
+static unsigned char store(struct cpu6510* c, int op) {
+   unsigned char v;
+   switch (op) {
+      case OP_STA: return c->a;
+      case OP_STX: return c->x;
+      case OP_STY: return c->y;
+      case OP_SAX: return c->a & c->x;
+      case OP_SHA: v = c->a & c->x & (c->val + 1); break;
+      case OP_SHX: v = c->x & (c->val + 1); break;
+      case OP_SHY: v = c->y & (c->val + 1); break;
+      case OP_TAS:
+         c->s = c->a & c->x;
+         v = c->s & (c->val + 1);
+         break;
+      default:
+         return 0;
+   }
+   if (c->crossed)
+      c->ad = (v << 8) | (c->ad & 0xff);
+   return v;
+}
+
+static unsigned char rmw(struct cpu6510* c, int op, unsigned char v) {
+   switch (op) {
+      case OP_INC: v++; set_nz(c, v); break;
+      case OP_DEC: v--; set_nz(c, v); break;
+      case OP_SLO: v = shift(c, op, v); c->a |= v; set_nz(c, c->a); break;
+      case OP_RLA: v = shift(c, op, v); c->a &= v; set_nz(c, c->a); break;
+      case OP_SRE: v = shift(c, op, v); c->a ^= v; set_nz(c, c->a); break;
+      case OP_RRA: v = shift(c, op, v); adc(c, v); break;
+      case OP_DCP: v--; compare(c, c->a, v); break;
+      case OP_ISC: v++; sbc(c, v); break;
+      default: v = shift(c, op, v); break;
+   }
+   return v;
+}
+
+static int taken(struct cpu6510* c, int op) {
+   switch (op) {
+      case OP_BPL: return !(c->p & CPU_FLAG_N);
+      case OP_BMI: return c->p & CPU_FLAG_N;
+      case OP_BVC: return !(c->p & CPU_FLAG_V);
+      case OP_BVS: return c->p & CPU_FLAG_V;
+      case OP_BCC: return !(c->p & CPU_FLAG_C);
+      case OP_BCS: return c->p & CPU_FLAG_C;
+      case OP_BNE: return !(c->p & CPU_FLAG_Z);
+      default: return c->p & CPU_FLAG_Z;
+   }
+}
+
+// Fetch the next opcode. If poll is set and an interrupt was seen in
+// the previous cycle, the fetched opcode is dropped in favour of BRK.
+static void fetch(struct cpu6510* c, int poll) {
+   c->intr = poll && c->poll;
+   RD(c, c->pc);
+   c->step = 0;
+}
+
+// The effective address is known, start the access(es) at it
+static void mem_begin(struct cpu6510* c, int op) {
+   if (kind_of(op) == K_WRITE) {
+      unsigned char v = store(c, op);
+      WR(c, c->ad, v);
+   } else {
+      RD(c, c->ad);
+   }
+   c->step = MEM_STEP;
+}
+
+static void mem_stage(struct cpu6510* c, int op, unsigned char d) {
+   int kind = kind_of(op);
+   switch (c->step) {
+      case MEM_STEP:
+         if (kind == K_READ) {
+            do_read(c, op, d);
+            fetch(c, 1);
+         } else if (kind == K_WRITE) {
+            fetch(c, 1);
+         } else {
+            // RMW writes the unmodified value back first
+            c->val = d;
+            WR(c, c->ad, c->val);
+            c->step++;
+         }
+         break;
+      case MEM_STEP + 1:
+         c->val = rmw(c, op, c->val);
+         WR(c, c->ad, c->val);
+         c->step++;
+         break;
+      default:
+         fetch(c, 1);
+         break;
+   }
+}
+
+// Add an index to lo and hi. The first read happens before the carry
+// into the high byte so it may be in the wrong page.
+static void indexed(struct cpu6510* c, int op, unsigned char hi,
+                    unsigned char idx) {
+   unsigned short base = c->lo | (hi << 8);
+   c->ad = base + idx;
+   c->val = hi;
+   c->crossed = ((c->ad ^ base) & 0xff00) != 0;
+   RD(c, (base & 0xff00) | (c->ad & 0xff));
+   if (kind_of(op) == K_READ && !c->crossed)
+      c->step = MEM_STEP;
+   else
+      c->step++;
+}
+
+void cpu_init(struct cpu6510* c, unsigned short pc) {
+   c->a = c->x = c->y = 0;
+   c->s = 0xfd;
+   c->p = CPU_FLAG_U | CPU_FLAG_I;
+   c->pc = pc;
+   c->irq = c->nmi = 0;
+   c->poll = 0;
+   c->nmiLast = 0;
+   c->nmiPending = 0;
+   c->jammed = 0;
+   c->cycles = 0;
+   fetch(c, 0);
+}
+
+void cpu_tick(struct cpu6510* c) {
+   unsigned char d = c->data;
+
+   c->cycles++;
+
+   if (c->step == 0) {
+      if (c->intr) {
+         c->ir = 0x00;
+      } else {
+         c->ir = d;
+         c->pc++;
+      }
+      c->step = 1;
+   }
+
+   int op = op_table[c->ir];
+   int mode = mode_table[c->ir];
+
+   if (c->step >= MEM_STEP) {
+      mem_stage(c, op, d);
+   } else switch (mode) {
+      case M_IMP:
+      case M_ACC:
+         if (c->step == 1) {
+            RD(c, c->pc);
+            c->step++;
+         } else {
+            implied(c, op);
+            fetch(c, 1);
+         }
+         break;
+      case M_IMM:
+         if (c->step == 1) {
+            RD(c, c->pc++);
+            c->step++;
+         } else {
+            do_read(c, op, d);
+            fetch(c, 1);
+         }
+         break;
+      case M_ZP:
+         if (c->step == 1) {
+            RD(c, c->pc++);
+            c->step++;
+         } else {
+            c->ad = d;
+            mem_begin(c, op);
+         }
+         break;
+      case M_ZPX:
+      case M_ZPY:
+         switch (c->step++) {
+            case 1: RD(c, c->pc++); break;
+            case 2: c->ad = d; RD(c, c->ad); break;
+            default:
+               c->ad = (c->ad + (mode == M_ZPX ? c->x : c->y)) & 0xff;
+               mem_begin(c, op);
+               break;
+         }
+         break;
+      case M_ABS:
+         switch (c->step++) {
+            case 1: RD(c, c->pc++); break;
+            case 2: c->lo = d; RD(c, c->pc++); break;
+            default:
+               c->ad = c->lo | (d << 8);
+               mem_begin(c, op);
+               break;
+         }
+         break;
+      case M_ABX:
+      case M_ABY:
+         switch (c->step) {
+            case 1: RD(c, c->pc++); c->step++; break;
+            case 2: c->lo = d; RD(c, c->pc++); c->step++; break;
+            case 3: indexed(c, op, d, mode == M_ABX ? c->x : c->y); break;
+            default: mem_begin(c, op); break;
+         }
+         break;
+      case M_IZX:
+         switch (c->step++) {
+            case 1: RD(c, c->pc++); break;
+            case 2: c->ad = d; RD(c, c->ad); break;
+            case 3: c->ad = (c->ad + c->x) & 0xff; RD(c, c->ad); break;
+            case 4: c->lo = d; RD(c, (c->ad + 1) & 0xff); break;
+            default:
+               c->ad = c->lo | (d << 8);
+               mem_begin(c, op);
+               break;
+         }
+         break;
+      case M_IZY:
+         switch (c->step) {
+            case 1: RD(c, c->pc++); c->step++; break;
+            case 2: c->ad = d; RD(c, c->ad); c->step++; break;
+            case 3: c->lo = d; RD(c, (c->ad + 1) & 0xff); c->step++; break;
+            case 4: indexed(c, op, d, c->y); break;
+            default: mem_begin(c, op); break;
+         }
+         break;
+      case M_REL:
+         switch (c->step++) {
+            case 1: RD(c, c->pc++); break;
+            case 2:
+               if (!taken(c, op)) {
+                  fetch(c, 1);
+               } else {
+                  RD(c, c->pc);
+                  c->ad = c->pc + (signed char) d;
+               }
+               break;
+            case 3:
+               if ((c->ad ^ c->pc) & 0xff00) {
+                  RD(c, (c->pc & 0xff00) | (c->ad & 0xff));
+                  c->pc = c->ad;
+               } else {
+                  // A taken branch that stays in the page doesn't
+                  // look at interrupts
+                  c->pc = c->ad;
+                  fetch(c, 0);
+               }
+               break;
+            default:
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_BRK:
+         switch (c->step++) {
+            case 1:
+               if (c->intr)
+                  RD(c, c->pc);
+               else
+                  RD(c, c->pc++);
+               break;
+            case 2: WR(c, 0x100 | c->s--, c->pc >> 8); break;
+            case 3: WR(c, 0x100 | c->s--, c->pc & 0xff); break;
+            case 4:
+               WR(c, 0x100 | c->s--,
+                  c->p | CPU_FLAG_U | (c->intr ? 0 : CPU_FLAG_B));
+               break;
+            case 5:
+               // A pending NMI takes over the vector fetch
+               c->ad = c->nmiPending ? 0xfffa : 0xfffe;
+               c->nmiPending = 0;
+               c->p |= CPU_FLAG_I;
+               RD(c, c->ad);
+               break;
+            case 6: c->lo = d; RD(c, c->ad + 1); break;
+            default:
+               c->pc = c->lo | (d << 8);
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_JSR:
+         switch (c->step++) {
+            case 1: RD(c, c->pc++); break;
+            case 2: c->lo = d; RD(c, 0x100 | c->s); break;
+            case 3: WR(c, 0x100 | c->s--, c->pc >> 8); break;
+            case 4: WR(c, 0x100 | c->s--, c->pc & 0xff); break;
+            case 5: RD(c, c->pc); break;
+            default:
+               c->pc = c->lo | (d << 8);
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_RTS:
+         switch (c->step++) {
+            case 1: RD(c, c->pc); break;
+            case 2: RD(c, 0x100 | c->s); break;
+            case 3: RD(c, 0x100 | ++c->s); break;
+            case 4: c->lo = d; RD(c, 0x100 | ++c->s); break;
+            case 5:
+               c->pc = c->lo | (d << 8);
+               RD(c, c->pc++);
+               break;
+            default:
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_RTI:
+         switch (c->step++) {
+            case 1: RD(c, c->pc); break;
+            case 2: RD(c, 0x100 | c->s); break;
+            case 3: RD(c, 0x100 | ++c->s); break;
+            case 4:
+               c->p = (d & ~CPU_FLAG_B) | CPU_FLAG_U;
+               RD(c, 0x100 | ++c->s);
+               break;
+            case 5: c->lo = d; RD(c, 0x100 | ++c->s); break;
+            default:
+               c->pc = c->lo | (d << 8);
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_PSH:
+         switch (c->step++) {
+            case 1: RD(c, c->pc); break;
+            case 2:
+               WR(c, 0x100 | c->s--, op == OP_PHA ?
+                  c->a : c->p | CPU_FLAG_B | CPU_FLAG_U);
+               break;
+            default:
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_PUL:
+         switch (c->step++) {
+            case 1: RD(c, c->pc); break;
+            case 2: RD(c, 0x100 | c->s); break;
+            case 3: RD(c, 0x100 | ++c->s); break;
+            default:
+               if (op == OP_PLA) {
+                  c->a = d;
+                  set_nz(c, d);
+               } else {
+                  c->p = (d & ~CPU_FLAG_B) | CPU_FLAG_U;
+               }
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_JMP:
+         switch (c->step++) {
+            case 1: RD(c, c->pc++); break;
+            case 2: c->lo = d; RD(c, c->pc); break;
+            default:
+               c->pc = c->lo | (d << 8);
+               fetch(c, 1);
+               break;
+         }
+         break;
+      case M_JMI:
+         switch (c->step++) {
+            case 1: RD(c, c->pc++); break;
+            case 2: c->lo = d; RD(c, c->pc++); break;
+            case 3: c->ad = c->lo | (d << 8); RD(c, c->ad); break;
+            case 4:
+               // The pointer's high byte never carries into the next page
+               c->lo = d;
+               RD(c, (c->ad & 0xff00) | ((c->ad + 1) & 0xff));
+               break;
+            default:
+               c->pc = c->lo | (d << 8);
+               fetch(c, 1);
+               break;
+         }
+         break;
+      default:
+         // JAM. Only a reset gets us out of here.
+         c->jammed = 1;
+         RD(c, 0xffff);
+         break;
+   }
+
+   // NMI is edge triggered, IRQ is a level. Both are looked at one
+   // cycle before the next opcode fetch.
+   if (c->nmi && !c->nmiLast)
+      c->nmiPending = 1;
+   c->nmiLast = c->nmi;
+   c->poll = c->nmiPending || (c->irq && !(c->p & CPU_FLAG_I));
+}
@@ -0,0 +1,80 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_CPU6510_H
+#define VICII_CPU6510_H
+
+// A cycle stepped NMOS 6510 core (including the undocumented opcodes).
+//
+// The core performs exactly one bus access per cycle and knows nothing
+// about memory.  After cpu_tick() the access for the next cycle is in
+// addr/rw (and data for a write).  The caller carries out the access,
+// puts what was read in data and calls cpu_tick() again to finish it.
+// To hold the CPU (RDY low on a read, or AEC low) simply don't call
+// cpu_tick() for that cycle; the same access is presented again.
+//
+// The port at $00/$01 is part of the memory map and is left to the
+// caller.
+
+#define CPU_FLAG_C 0x01
+#define CPU_FLAG_Z 0x02
+#define CPU_FLAG_I 0x04
+#define CPU_FLAG_D 0x08
+#define CPU_FLAG_B 0x10
+#define CPU_FLAG_U 0x20
+#define CPU_FLAG_V 0x40
+#define CPU_FLAG_N 0x80
+
+struct cpu6510 {
+   unsigned short pc;
+   unsigned char a;
+   unsigned char x;
+   unsigned char y;
+   unsigned char s;
+   unsigned char p;
+
+   // Bus access for the current cycle. rw is 1 for read.
+   unsigned short addr;
+   unsigned char data;
+   int rw;
+
+   // Interrupt lines, set by the caller before each cycle (1=asserted)
+   int irq;
+   int nmi;
+
+   // Internal sequencing
+   unsigned char ir;
+   int step;
+   unsigned short ad;
+   unsigned char lo;
+   unsigned char val;
+   int crossed;
+   int intr;
+   int poll;
+   int nmiLast;
+   int nmiPending;
+   int jammed;
+
+   unsigned long cycles;
+};
+
+// Set registers and start fetching the first opcode from pc
+void cpu_init(struct cpu6510* c, unsigned short pc);
+
+// Finish the current bus access and set up the next one
+void cpu_tick(struct cpu6510* c);
+
+#endif
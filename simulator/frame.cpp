@@ -0,0 +1,66 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "log.h"
+
+struct frame_buffer* fb_init(int width, int height) {
+   struct frame_buffer* fb = (struct frame_buffer*)
+       malloc(sizeof(struct frame_buffer));
+   fb->width = width;
+   fb->height = height;
+   fb->pixels = (unsigned int*) calloc(width * height, sizeof(unsigned int));
+   return fb;
+}
+
+void fb_free(struct frame_buffer* fb) {
+   free(fb->pixels);
+   free(fb);
+}
+
+int fb_write_ppm(struct frame_buffer* fb, const char* pattern, long frame_num) {
+   char filename[256];
+   snprintf(filename, sizeof(filename), pattern, (int) frame_num);
+
+   FILE* fp = fopen(filename, "wb");
+   if (fp == NULL) {
+      LOG(LOG_ERROR, "can't write frame to %s", filename);
+      return 1;
+   }
+
+   fprintf(fp, "P6\n%d %d\n255\n", fb->width, fb->height);
+
+   // One row at a time, ARGB -> packed RGB
+   unsigned char* row = (unsigned char*) malloc(fb->width * 3);
+   for (int y = 0; y < fb->height; y++) {
+      unsigned int* src = fb_line(fb, y);
+      unsigned char* dst = row;
+      for (int x = 0; x < fb->width; x++) {
+         unsigned int p = src[x];
+         *dst++ = (p >> 16) & 0xff;
+         *dst++ = (p >> 8) & 0xff;
+         *dst++ = p & 0xff;
+      }
+      fwrite(row, 1, fb->width * 3, fp);
+   }
+   free(row);
+   fclose(fp);
+   return 0;
+}
@@ -0,0 +1,59 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_FRAME_H
+#define VICII_FRAME_H
+
+// A contiguous ARGB8888 frame buffer the simulator renders into.
+//
+// The buffer is twice the chip's native width (we draw on both
+// dot_rising[1] and dot_rising[3]) and one row per raster line.
+// Nothing in here touches SDL so frames can be produced on machines
+// with no display.  Whole frames are handed to a file sink and/or
+// uploaded to the SDL window once they are complete.
+
+#define FB_RGB(r, g, b) \
+   (0xff000000u | ((unsigned int)(r) << 16) | \
+       ((unsigned int)(g) << 8) | (unsigned int)(b))
+
+struct frame_buffer {
+  int width;
+  int height;
+  unsigned int *pixels;
+};
+
+struct frame_buffer* fb_init(int width, int height);
+
+void fb_free(struct frame_buffer* fb);
+
+static inline void fb_put(struct frame_buffer* fb, int x, int y,
+                          unsigned int argb) {
+   if ((unsigned) x < (unsigned) fb->width &&
+          (unsigned) y < (unsigned) fb->height)
+      fb->pixels[y * fb->width + x] = argb;
+}
+
+static inline unsigned int* fb_line(struct frame_buffer* fb, int y) {
+   return fb->pixels + y * fb->width;
+}
+
+// Write the frame as a binary PPM.  If pattern contains a printf
+// style integer conversion (i.e. frame%04d.ppm) it is replaced with
+// frame_num, otherwise the same file is overwritten each time.
+// Return 1 on error, 0 success
+int fb_write_ppm(struct frame_buffer* fb, const char* pattern, long frame_num);
+
+#endif
@@ -0,0 +1,202 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framehash.h"
+#include "log.h"
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl(uint64_t v, int r) {
+   return (v << r) | (v >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char* p) {
+   uint64_t v;
+   memcpy(&v, p, 8);
+   return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+   uint32_t v;
+   memcpy(&v, p, 4);
+   return v;
+}
+
+static inline uint64_t xxRound(uint64_t acc, uint64_t input) {
+   acc += input * PRIME2;
+   return rotl(acc, 31) * PRIME1;
+}
+
+static inline uint64_t merge(uint64_t acc, uint64_t val) {
+   acc ^= xxRound(0, val);
+   return acc * PRIME1 + PRIME4;
+}
+
+// Reference XXH64 (little endian hosts)
+uint64_t xxh64(const void* data, size_t len, uint64_t seed) {
+   const unsigned char* p = (const unsigned char*) data;
+   const unsigned char* end = p + len;
+   uint64_t h;
+
+   if (len >= 32) {
+      uint64_t v1 = seed + PRIME1 + PRIME2;
+      uint64_t v2 = seed + PRIME2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - PRIME1;
+      do {
+         v1 = xxRound(v1, read64(p));
+         v2 = xxRound(v2, read64(p + 8));
+         v3 = xxRound(v3, read64(p + 16));
+         v4 = xxRound(v4, read64(p + 24));
+         p += 32;
+      } while (p + 32 <= end);
+      h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+      h = merge(h, v1);
+      h = merge(h, v2);
+      h = merge(h, v3);
+      h = merge(h, v4);
+   } else {
+      h = seed + PRIME5;
+   }
+
+   h += (uint64_t) len;
+
+   while (p + 8 <= end) {
+      h ^= xxRound(0, read64(p));
+      h = rotl(h, 27) * PRIME1 + PRIME4;
+      p += 8;
+   }
+   if (p + 4 <= end) {
+      h ^= (uint64_t) read32(p) * PRIME1;
+      h = rotl(h, 23) * PRIME2 + PRIME3;
+      p += 4;
+   }
+   while (p < end) {
+      h ^= (*p++) * PRIME5;
+      h = rotl(h, 11) * PRIME1;
+   }
+
+   h ^= h >> 33;
+   h *= PRIME2;
+   h ^= h >> 29;
+   h *= PRIME3;
+   h ^= h >> 32;
+   return h;
+}
+
+void fh_compute(struct frame_buffer* fb, struct frame_hash* h) {
+   if (h->numLines != fb->height) {
+      h->lines = (uint64_t*) realloc(h->lines, fb->height * sizeof(uint64_t));
+      h->numLines = fb->height;
+   }
+   for (int y = 0; y < fb->height; y++)
+      h->lines[y] = xxh64(fb_line(fb, y), fb->width * sizeof(unsigned int), 0);
+   h->frame = xxh64(h->lines, fb->height * sizeof(uint64_t), 0);
+}
+
+void fh_write(FILE* fp, const char* test, int chip, int config,
+              long frame_num, struct frame_hash* h) {
+   fprintf(fp, "%s %d %d %ld %016llx ", test, chip, config, frame_num,
+           (unsigned long long) h->frame);
+   for (int y = 0; y < h->numLines; y++)
+      fprintf(fp, y ? ",%016llx" : "%016llx",
+              (unsigned long long) h->lines[y]);
+   fprintf(fp, "\n");
+}
+
+struct hash_manifest* fh_load_manifest(const char* filename, const char* test,
+                                       int chip, int config) {
+   FILE* fp = fopen(filename, "r");
+   if (fp == NULL) {
+      LOG(LOG_ERROR, "can't read manifest %s", filename);
+      return nullptr;
+   }
+
+   struct hash_manifest* m = (struct hash_manifest*)
+       calloc(1, sizeof(struct hash_manifest));
+
+   // Records can be long (a hash per line)
+   size_t cap = 0;
+   char* line = nullptr;
+   while (getline(&line, &cap, fp) > 0) {
+      char name[256];
+      int c, cfg, n;
+      long frame_num;
+      unsigned long long frame;
+      if (line[0] == '#' ||
+             sscanf(line, "%255s %d %d %ld %llx %n", name, &c, &cfg,
+                    &frame_num, &frame, &n) != 5)
+         continue;
+      if (strcmp(name, test) != 0 || c != chip || cfg != config ||
+             frame_num < 0)
+         continue;
+
+      if (frame_num >= m->numFrames) {
+         m->frames = (struct frame_hash*) realloc(m->frames,
+             (frame_num + 1) * sizeof(struct frame_hash));
+         memset(m->frames + m->numFrames, 0,
+                (frame_num + 1 - m->numFrames) * sizeof(struct frame_hash));
+         m->numFrames = frame_num + 1;
+      }
+
+      struct frame_hash* h = &m->frames[frame_num];
+      free(h->lines);
+      h->frame = frame;
+      h->numLines = 0;
+      h->lines = nullptr;
+
+      // Line hashes are optional
+      char* p = line + n;
+      for (char* tok = strtok(p, ",\n"); tok; tok = strtok(NULL, ",\n")) {
+         h->lines = (uint64_t*) realloc(h->lines,
+                                        (h->numLines + 1) * sizeof(uint64_t));
+         h->lines[h->numLines++] = strtoull(tok, NULL, 16);
+      }
+   }
+   free(line);
+   fclose(fp);
+   return m;
+}
+
+void fh_free_manifest(struct hash_manifest* m) {
+   for (int i = 0; i < m->numFrames; i++)
+      free(m->frames[i].lines);
+   free(m->frames);
+   free(m);
+}
+
+int fh_compare(struct hash_manifest* m, long frame_num, struct frame_hash* h) {
+   if (frame_num >= m->numFrames || m->frames[frame_num].frame == 0)
+      return -2;
+
+   struct frame_hash* g = &m->frames[frame_num];
+   if (g->frame == h->frame)
+      return -1;
+
+   int n = g->numLines < h->numLines ? g->numLines : h->numLines;
+   for (int y = 0; y < n; y++)
+      if (g->lines[y] != h->lines[y])
+         return y;
+   return n;
+}
@@ -0,0 +1,66 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_FRAMEHASH_H
+#define VICII_FRAMEHASH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "frame.h"
+
+// Content hashes of rendered frames so a regression run can tell which
+// frames changed without keeping images around.
+//
+// Each raster line of the frame buffer is hashed with XXH64 and the
+// frame hash is the XXH64 of the line hashes.  A run writes one record
+// per frame:
+//
+//    <test> <chip> <config> <frame> <frame hash> <line hash>,<line hash>...
+//
+// A golden manifest is just such a file from a run we trust.  Records
+// for other tests, chips or configs are ignored when it is loaded.
+
+uint64_t xxh64(const void* data, size_t len, uint64_t seed);
+
+struct frame_hash {
+   uint64_t frame;
+   int numLines;
+   uint64_t* lines;
+};
+
+struct hash_manifest {
+   int numFrames;
+   struct frame_hash* frames;   // indexed by frame number
+};
+
+// Hash every line of fb into h (lines are allocated as needed)
+void fh_compute(struct frame_buffer* fb, struct frame_hash* h);
+
+void fh_write(FILE* fp, const char* test, int chip, int config,
+              long frame_num, struct frame_hash* h);
+
+// Return null on error
+struct hash_manifest* fh_load_manifest(const char* filename, const char* test,
+                                       int chip, int config);
+
+void fh_free_manifest(struct hash_manifest* m);
+
+// Returns -2 if the manifest has no such frame, -1 if it matches or the
+// first raster line that differs.
+int fh_compare(struct hash_manifest* m, long frame_num, struct frame_hash* h);
+
+#endif
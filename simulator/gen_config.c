@@ -51,6 +51,7 @@ enum DefineValues {
    WITH_4K,              // select 4K for ram
    WITH_BLITTER,         // include blitter
    EFINIX,
+   SIM_FEATURES,         // (for simulator) optional features switchable at run time
 };
 
 Define defines[] = {
@@ -75,6 +76,7 @@ Define defines[] = {
   {WITH_4K ,0,0,"WITH_4K"},
   {WITH_BLITTER ,0,0,"WITH_BLITTER"},
   {EFINIX ,0,0,"EFINIX"},
+  {SIM_FEATURES ,0,0,"SIM_FEATURES"},
 };
 
 void printcfg(int d, int def) {
@@ -114,6 +116,7 @@ void with_math(int d) { printcfg(d, WITH_MATH); with_ext(d); }
 // TODO: Fix this and also math reg requirement.
 void with_blitter(int d) { printcfg(d, WITH_BLITTER); hires_modes(d); with_64k(d); with_math(d);}
 void efinix(int d) { printcfg(d, EFINIX); }
+void sim_features(int d) { printcfg(d, SIM_FEATURES); }
 
 int main(int argc, char* argv[]) {
 
@@ -208,6 +211,23 @@ int main(int argc, char* argv[]) {
                     with_dvi(d);
                     efinix(d);
 		    break;
+	    case 11:
+	            // Simulator superset. Everything that can live in one
+	            // model; vicsim -F picks which of extensions, math,
+	            // hires and blitter are usable so one build covers
+	            // the register level differences of configs 0, 1, 7,
+	            // 8 and 10.
+		    gen_luma_chroma(d);
+		    luma_sink(d);
+		    have_flash(d);
+		    with_dvi(d);
+		    gen_rgb(d);
+		    configurable_rgb(d);
+		    configurable_lumas(d);
+		    with_64k(d);
+		    with_blitter(d);
+		    sim_features(d);
+		    break;
 	    default:
 		    break;
 
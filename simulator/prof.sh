@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Run the canned scenarios on a model built with --prof-cfuncs and -pg
+# (make prof) and report where eval time goes by Verilog module.
+#
+# usage: prof.sh [-f frames] [-s "scenarios"] [vtop]
+#
+# Each run leaves its own gmon.out.<pid>.  They are summed, run through
+# gprof and then verilator_profcfunc, which maps the --prof-cfuncs
+# function names back to modules and source lines.
+
+FRAMES=2
+SCENARIOS="text sprites hires2 blit"
+PROFCFUNC=${VERILATOR_PROFCFUNC:-verilator_profcfunc}
+
+while getopts "f:s:" opt
+do
+   case $opt in
+      f) FRAMES=$OPTARG ;;
+      s) SCENARIOS=$OPTARG ;;
+      *) exit 1 ;;
+   esac
+done
+shift $((OPTIND - 1))
+VTOP=${1:-obj_dir_prof/Vtop}
+DIR=$(dirname $VTOP)
+
+rm -f $DIR/gmon.out.* $DIR/gmon.sum
+for s in $SCENARIOS
+do
+   GMON_OUT_PREFIX=$DIR/gmon.out $VTOP -M $s -c 1 -n $FRAMES -l 0 > /dev/null || exit 1
+done
+
+gprof -s $VTOP $DIR/gmon.out.* || exit 1
+mv gmon.sum $DIR/gmon.sum
+gprof $VTOP $DIR/gmon.sum > $DIR/gprof.out || exit 1
+$PROFCFUNC $DIR/gprof.out > $DIR/prof_modules.txt || exit 1
+
+# Just the per module summary here, the per line detail follows it
+sed -n '/by module/,/^$/p' $DIR/prof_modules.txt | grep . ||
+   head -40 $DIR/prof_modules.txt
+echo "full report in $DIR/prof_modules.txt, gprof output in $DIR/gprof.out"
@@ -21,16 +21,30 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <verilated.h>
 #include <regex.h>
 
 #include "Vtop.h"
+#include "bench.h"
+#include "c64.h"
+#include "clocks.h"
 #include "constants.h"
-
-#if VM_TRACE
-#include <verilated_vcd_c.h>
+#include "frame.h"
+#include "stimulus.h"
+#include "vsf.h"
+#include "framehash.h"
+#include "statelog.h"
+#include "stats.h"
+#include "trace.h"
+#include "watch.h"
+
+#ifdef SIM_SAVABLE
+#include <sys/stat.h>
+#include <verilated_save.h>
 #endif
 
 extern "C" {
@@ -44,39 +58,47 @@ static vluint64_t half4XDotPS;
 static vluint64_t half16XColPS;
 static vluint64_t startTicks;
 static vluint64_t endTicks;
-static vluint64_t nextClk;
-static vluint64_t next16XColClk;
-static double col4xClk;
-static double col16xClk;
 static int nextClkCnt;
+static struct sim_clocks clocks;
+static struct sim_clock* dot4xClock;
+
+// Set by the multi-threaded build so benchmark output can report it
+#ifndef SIM_THREADS
+#define SIM_THREADS 1
+#endif
+
+// gen_config configuration we were built with, keys frame hashes
+#ifndef SIM_CONFIG_ID
+#define SIM_CONFIG_ID 0
+#endif
 static int screenWidth;
 static int screenHeight;
 static int lastXPos;
 static int numCycles;
 
+// Set when the state table goes to a binary log (-L)
+static bool stateLogging;
+
+// Window presentation. Raster lines written since the last texture
+// upload are kept as a dirty range and copied in one go. Presents
+// are limited to the display's refresh rate.
+static int dirtyFirst = -1;
+static int dirtyLast = -1;
+static Uint64 presentInterval;
+static Uint64 lastPresent;
+
 // Some utility macros
 // Use RISING/FALLING in combination with HASCHANGED
 
-#define HASCHANGED(signum) \
-   ( SGETVAL(signum) != prev_signal_values[signum] )
-#define RISING(signum) \
-   ( SGETVAL(signum))
-#define FALLING(signum) \
-   ( !SGETVAL(signum))
+#define HASCHANGED(signum) watch_changed(signum)
+#define RISING(signum) watch_high(signum)
+#define FALLING(signum) (!watch_high(signum))
 
-// Add new input/output here
+// Add new input/output here (and to the watch table in main)
 enum {
    OUT_DOT = 0, OUT_DOT_RISING,
 };
 
-#define NUM_SIGNALS 2
-
-static unsigned int signal_width[NUM_SIGNALS];
-static unsigned char *signal_src8[NUM_SIGNALS];
-static unsigned short *signal_src16[NUM_SIGNALS];
-static unsigned int signal_bit[NUM_SIGNALS];
-static unsigned char prev_signal_values[NUM_SIGNALS];
-
 // Used when no RGB is avaiable (i.e. composite only)
 int native_rgb[] = {
 0,0,0,
@@ -98,171 +120,72 @@ int native_rgb[] = {
 };
 
 
-static char cycleToChar(int cycle){
-  switch (cycle) {
-    case VIC_LP   : return '#';
-    case VIC_LPI2 : return 'i';
-    case VIC_LS2  : return 's';
-    case VIC_LR   : return 'r';
-    case VIC_LG   : return 'g';
-    case VIC_HS1  : return 'S';
-    case VIC_HPI1 : return 'I';
-    case VIC_HPI3 : return 'I';
-    case VIC_HS3  : return 'S';
-    case VIC_HRI  : return 'I';
-    case VIC_HRC  : return 'C';
-    case VIC_HGC  : return 'C';
-    case VIC_HGI  : return 'I';
-    case VIC_HI   : return 'I';
-    case VIC_LI   : return 'i';
-    case VIC_HRX  : return 'x';
-    default:
-       LOG(LOG_ERROR,"bad cycle");
-       exit(-1);
-  }
-}
-
-// TODO : Add a signal_shift so we can shift before we mask with signal
-// bit in case we want to isolate higher bits of a signal?
-static int SGETVAL(int signum) {
-  if (signal_width[signum] == 1) {
-     // When width is 1, we can pick out any bit
-     return (*signal_src8[signum] & signal_bit[signum] ? 1 : 0);
-  } else if (signal_width[signum] <= 8) {
-     return (*signal_src8[signum] & signal_bit[signum]);
-  } else if (signal_width[signum] > 8 && signal_width[signum] < 16) {
-     return (*signal_src16[signum] & signal_bit[signum]);
-  } else {
-    abort();
-  }
+static void HEADER(Vtop *top) {
+   LOG(LOG_VERBOSE, "%s", statelog_titles);
 }
 
-static void HEADER(Vtop *top) {
-   LOG(LOG_VERBOSE,
-   "  "
-   "D4X "
-   "CNT "
-   "POS "
-   "CYC "
-   "DOTR "
-   "PHI "
-   "BIT "
-   "IRQ "
-   "BA "
-   "AEC "
-   "VCY "
-   "RAS "
-   "CAS "
-   " X  "
-   " Y  "
-   " Y  "
-   "ADI  "
-   "ADO  "
-   "DBI "
-   "DBO "
-   "RW "
-   "CE "
-   "RFC "
-   "BIN"
-  );
+// Fill in one row of the state table
+static void GETSTATE(Vtop *top, struct state_rec* r) {
+   bool dotRise = HASCHANGED(OUT_DOT) && RISING(OUT_DOT);
+
+   r->flags = (top->V_RST ? SR_RST : 0) |
+              (dotRise ? SR_DOT_RISE : 0) |
+              (top->V_DOT4X ? SR_D4X : 0) |
+              (top->V_CLK_DOT & 8 ? SR_DOTR : 0) |
+              (top->clk_phi ? SR_PHI : 0) |
+              (top->irq ? SR_IRQ : 0) |
+              (top->ba ? SR_BA : 0) |
+              (top->aec ? SR_AEC : 0) |
+              (top->ras ? SR_RAS : 0) |
+              (top->cas ? SR_CAS : 0) |
+              (top->rw ? SR_RW : 0) |
+              (top->ce ? SR_CE : 0) |
+              (top->V_BADLINE ? SR_BADLINE : 0) |
+              (top->V_BMM ? SR_BMM : 0);
+   r->cnt = nextClkCnt;
+   r->cycleNum = top->V_CYCLE_NUM;
+   r->cycleBit = top->V_CYCLE_BIT;
+   r->cycleType = top->V_CYCLE_TYPE;
+   r->dbi = top->V_DBI;
+   r->dbo = top->V_DBO;
+   r->refc = top->V_REFC;
+   r->rc = top->V_RC;
+   r->spriteMc = top->V_SPRITE_MC[0];
+   r->spriteMcBase = top->V_SPRITE_MCBASE[0];
+   r->xpos = top->V_XPOS;
+   r->rasterX = top->V_RASTER_X;
+   r->rasterLine = top->V_RASTER_LINE;
+   r->rasterLineD = top->V_RASTER_LINE_D;
+   r->adi = top->adl;
+   r->ado = top->V_ADO;
+   r->vicAddr = top->V_VICADDR;
+   r->pps = top->V_PPS;
+   r->phir = top->V_PHIR;
 }
 
+// One row of the state table per half cycle. With -L it goes to the
+// binary log (see statedump), otherwise it is printed at log level 4.
 static void STATE(Vtop *top) {
    if ((top->V_DOT4X & 1) == 0) return;
 
-   if(HASCHANGED(OUT_DOT) && RISING(OUT_DOT))
-      HEADER(top);
+   if (stateLogging) {
+      GETSTATE(top, statelog_next());
+      return;
+   }
+   if (logLevel < LOG_VERBOSE) return;
 
-   LOG(LOG_VERBOSE,
-   "%c "      /*DOT*/
-   "%01d   "   /*D4x*/
-   "%02d  "   /*CNT*/
-   "%03x "   /*POS*/
-   " %02d "  /*CYC*/
-   " %01d  "   /*DOTR*/
-   " %01d  "   /*PHI*/
-   " %01d  "   /*BIT*/
-   " %01d  "   /*IRQ*/
-   " %01d  "   /*BA */
-   " %01d  "   /*AEC*/
-   "%c  "     /*VCY*/
-   " %01d  "   /*RAS*/
-   " %01d  "   /*CAS*/
-   "%03d "   /*  X*/
-   "%03d "   /*  Y*/
-   "%03d "   /*  Y*/
-   "%04x "   /*ADI*/
-   "%04x "   /*ADO*/
-   " %02x "   /*DBI*/
-   " %02x "   /*DBO*/
-   " %01d "   /* RW*/
-   " %01d "   /* CE*/
-   "%02x "   /*RFC*/
-   " %s"     /*BIN*/
-   " %s"     /*BIN*/
-   " %s"     /*BIN*/
-   " %d"     /*badline*/
-
-   " %03d"
-   " %03d"
-   " %01d"
-   " %04x"
-   " %01d"
-   ,
-
-   top->V_RST ? 'R' : HASCHANGED(OUT_DOT) && RISING(OUT_DOT) ? '*' : ' ',
-   top->V_DOT4X ? 1 : 0,
-   nextClkCnt,
-   top->V_XPOS,
-   top->V_CYCLE_NUM,
-   top->V_CLK_DOT & 8 ? 1 : 0,
-   top->clk_phi,
-   top->V_CYCLE_BIT,
-   top->irq,
-   top->ba,
-   top->aec,
-   cycleToChar(top->V_CYCLE_TYPE),
-   top->ras,
-   top->cas,
-   top->V_RASTER_X,
-   top->V_RASTER_LINE,
-   top->V_RASTER_LINE_D,
-   top->adl,
-   top->V_ADO,
-   top->V_DBI,
-   top->V_DBO,
-   top->rw,
-   top->ce,
-   top->V_REFC,
-
-   //toBin(16, top->V_RASR),
-   //toBin(16, top->V_CASR),
-
-   toBin(16, top->V_PPS),
-   toBin(32, top->V_PHIR),
-   " ",
-
-   //toBin(16, top->V_DOTRISINGR),
-   //toBin(32, top->V_DOTR),
-   //" ",
-
-   top->V_BADLINE,
-
-   top->V_SPRITE_MC[0],
-   top->V_SPRITE_MCBASE[0],
-   top->V_RC,
-   top->V_VICADDR,
-   top->V_BMM
-   //top->V_NEXTCHAR
-   );
+   struct state_rec r;
+   char line[256];
+   GETSTATE(top, &r);
+   if (r.flags & SR_DOT_RISE)
+      HEADER(top);
+   LOG(LOG_VERBOSE, "%s", statelog_format(&r, line));
 }
 
 
 
 static void STORE_PREV() {
-  for (int i = 0; i < NUM_SIGNALS; i++) {
-     prev_signal_values[i] = SGETVAL(i);
-  }
+  watch_store();
 }
 
 
@@ -270,81 +193,524 @@ static void CHECK(Vtop *top, int cond, int line) {
   if (!cond) {
      printf ("FAIL line %d:", line);
      STATE(top);
+#if VM_TRACE
+     trace_check_failed();
+#endif
+     statelog_close();
      exit(-1);
   }
 }
 
+// What the dot clock checks need, see checkDotRise
+struct dot_checks {
+   Vtop* top;
+   int chip;
+   const bool* capture;
+};
+
+// Run on every rising edge of the dot clock (a watch_on callback)
+static void checkDotRise(int id, void* arg) {
+  struct dot_checks* d = (struct dot_checks*) arg;
+  Vtop* top = d->top;
+  int chip = d->chip;
+  if (!*d->capture)
+     return;
+
+  // AEC should always be low in first phase. But AEC is
+  // slightly delayed so don't check this when bit cycle is 0
+  if (top->V_CYCLE_BIT > 0 && top->V_CYCLE_BIT < 4) {
+    CHECK(top, top->aec == 0, __LINE__);
+  }
+
+  // Make sure xpos is what we expect at key points
+  if (top->V_CYCLE_NUM == 12 && top->V_CYCLE_BIT == 4)
+    CHECK (top, top->V_XPOS == 0, __LINE__); // rollover
+
+  if (top->V_CYCLE_NUM == 0 && top->V_CYCLE_BIT == 0)
+    if (chip == CHIP6569R1 || chip == CHIP6569R3)
+       CHECK (top, top->V_XPOS == 0x194, __LINE__); // reset
+    else
+       CHECK (top, top->V_XPOS == 0x19c, __LINE__); // reset
+
+  if (chip == CHIP6567R8)
+    if (top->V_CYCLE_NUM == 61 && (top->V_CYCLE_BIT == 0 || top->V_CYCLE_BIT == 4))
+       CHECK (top, top->V_XPOS == 0x184, __LINE__); // repeat cases
+    else if (top->V_CYCLE_NUM == 62 && top->V_CYCLE_BIT == 0)
+       CHECK (top, top->V_XPOS == 0x184, __LINE__); // repeat case
+
+  // Refresh counter is supposed to reset at raster 0
+  //if (top->V_RASTER_X == 0 && top->V_RASTER_LINE == 0) TODO Put back
+  //   CHECK (top, top->V_REFC == 0xff, __LINE__);
+}
+
 // We can drive our simulated clock gen every pico second but that would
 // be a waste since nothing happens between clock edges. This function
-// will determine how many ticks(picoseconds) to advance our clock.
+// advances the clock scheduler through the next dot4x edge, evaluating
+// the model once for every distinct edge time along the way (col16x
+// edges fall between dot4x edges). Returns the time of the dot4x edge.
 
-// tick_scale_* simulates a clk_dvi signal that is slower in the right
+// The dvi clock is a gated copy of dot4x that is slower in the right
 // fraction of the master dot4x clock.  For efinix, we use a slower clock
 // (13/16 for NTSC and 15/16 for PAL) and chop off some of the border area.
 // For spartan, the full resolution is used so clk_dot4x = clk_dvi.
 
 #ifdef EFINIX
 #ifdef WITH_DVI
-static long tc = 0;
-static int tick_scale_pal[] = {1,1,1,1,1,1,1,1,0,1,1,1,1,1,1,1};
-static int tick_scale_ntsc[] = {1,1,1,0,1,1,1,1,0,1,1,1,0,1,1,1};
+#define DVI_GATE_PAL  0xfeff // skip step 8
+#define DVI_GATE_NTSC 0xeef7 // skip steps 3, 8, 12
 #endif
 #endif
 
-double col16xtick = 0;
+static vluint64_t nextTick(Vtop* top) {
+   uint64_t tickStart = stats_begin();
+   vluint64_t dot4xEdge = dot4xClock->next_edge;
+   vluint64_t t;
 
-static vluint64_t nextTick(Vtop* top, VerilatedVcdC* tfp, int chip) {
-   vluint64_t diff1 = nextClk - ticks;
+   do {
+      t = clocks_advance(&clocks);
+      uint64_t evalStart = stats_begin();
+      top->eval();
+      stats_end(STAT_EVAL, evalStart);
+#if VM_TRACE
+      trace_dump(t / TICKS_TO_TIMESCALE);
+#endif
+   } while (t < dot4xEdge);
 
-   nextClk += half4XDotPS;
+   nextClkCnt = (nextClkCnt + 1) % 32;
+   stats_end(STAT_TICK, tickStart);
+   return t;
+}
 
-   top->V_DOT4X = ~top->V_DOT4X;
-   
-#ifdef EFINIX
-#ifdef WITH_DVI
-   // Emulate our dvi clock in the correct fraction of the dot4x clock
-   if (chip & 1) {
-      if (tick_scale_pal[tc])
-         top->V_CLK_DVI = ~top->V_CLK_DVI;
+// Determine the color of the current pixel from whatever video
+// outputs this configuration has.
+static unsigned int pixelColor(Vtop* top, bool hideSync, bool showActive) {
+   unsigned int color = FB_RGB(0, 0, 0);
+#ifdef GEN_RGB
+   // Show h/v sync in red
+   if (!hideSync && (!top->hsync || !top->vsync))
+      color = FB_RGB(255, 0, 0);
+   else
+      color = FB_RGB(top->red * 255 / 63,
+                     top->green * 255 / 63,
+                     top->blue * 255 / 63);
+
+   // PURPLE ACTIVE AREA - DEBUGGING
+   if (showActive && (top->active))
+      color = FB_RGB(255, 0, 255);
+#else
+#ifdef NEED_RGB
+   // Show h/v sync in red
+   if (!hideSync && (top->HSYNC || top->VSYNC))
+      color = FB_RGB(255, 0, 0);
+   else
+      color = FB_RGB(top->top__DOT__red * 255 / 63,
+                     top->top__DOT__green * 255 / 63,
+                     top->top__DOT__blue * 255 / 63);
+
+   // PURPLE ACTIVE AREA - DEBUGGING
+   if (showActive && (top->ACTIVE))
+      color = FB_RGB(255, 0, 255);
+#else
+#ifdef GEN_LUMA_CHROMA
+   // Fallback to native pixel sequencer's pixel3 value
+   // and lookup colors.
+   int hss = 10; // see comp_sync.v  top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__hsync_start;
+   int hse = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__hsync_end;
+   int vss = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vblank_start;
+   //int vse = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vblank_end;
+   int vve = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vvisible_end;
+   int vvs = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vvisible_start;
+   // This is the same condition in comp_sync.v
+   int vsync = (top->V_RASTER_LINE >= vve && top->V_RASTER_LINE <= vvs);
+   // If we're not in vsync or within native active range, show pixel colors
+   if ((!vsync && top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__native_active) || hideSync) {
+      int index = top->top__DOT__vic_inst__DOT__pixel_color3;
+      color = FB_RGB((native_rgb[index*3] << 2) | 0b11,
+                     (native_rgb[index*3+1] << 2) | 0b11,
+                     (native_rgb[index*3+2] << 2) | 0b11);
    } else {
-      if (tick_scale_ntsc[tc])
-         top->V_CLK_DVI = ~top->V_CLK_DVI;
+      // NOTE: If we're in vsync show red color, except we omit vve and vss to match what comp_sync.v does
+      // (special cases)
+      if ((top->V_RASTER_X >= hss && top->V_RASTER_X < hse) ||
+             (vsync && top->V_RASTER_LINE != vve && top->V_RASTER_LINE != vvs))
+#ifdef HAVE_LUMA_SINK
+         color = FB_RGB(255*top->V_LUMA_SINK, 0, 0);
+#else
+         // Only for old beta boards
+         color = FB_RGB(255, 0, 0);
+#endif
    }
-
-   tc++;
-   if (tc>=16) tc=0;
+#else
+#warning "There are no video output options available. Simulator will show nothing"
+#endif
 #endif
 #endif
+   return color;
+}
 
-   top->V_COL4X = ~top->V_COL4X;
+static void markDirty(int first, int last) {
+   if (first < 0)
+      return;
+   if (dirtyLast < 0 || first < dirtyFirst)
+      dirtyFirst = first;
+   if (last > dirtyLast)
+      dirtyLast = last;
+}
 
-   // One tick of dot4x 
-   // = 9/4 ticks of col16x for PAL, 7/4 ticks of col16x for NTSC
+// Copy dirty lines of the frame buffer to the texture.
+static void uploadDirty(SDL_Texture* tex, struct frame_buffer* fb) {
+   if (dirtyLast < 0)
+      return;
+   SDL_Rect rect = {0, dirtyFirst, fb->width, dirtyLast - dirtyFirst + 1};
+   SDL_UpdateTexture(tex, &rect, fb_line(fb, dirtyFirst),
+                     fb->width * sizeof(unsigned int));
+   dirtyFirst = -1;
+   dirtyLast = -1;
+}
 
-   if (chip & 1) {
-       col16xtick += 9.0f/4.0d;
-   } else {
-       col16xtick += 7.0f/4.0d;
+// Show the frame buffer in the window. The renderer scale stretches
+// it 2x vertically.  The scanline cursor is drawn over the texture
+// below line.
+static void showFrame(SDL_Renderer* ren, SDL_Texture* tex,
+                      struct frame_buffer* fb, bool scanline, int line) {
+   uploadDirty(tex, fb);
+   SDL_RenderCopy(ren, tex, NULL, NULL);
+   if (scanline && line >= 0) {
+      SDL_SetRenderDrawColor(ren, 255, 255, 255, 255);
+      SDL_RenderDrawLine(ren, 0, line+1, fb->width-1, line+1);
    }
+   SDL_RenderPresent(ren);
+   lastPresent = SDL_GetPerformanceCounter();
+}
 
-   next16XColClk = nextClk;
-   while (col16xtick >= 1) {
-       top->V_COL16X = ~top->V_COL16X;
-       top->eval();
-#if VM_TRACE
-       if (tfp) tfp->dump(next16XColClk / TICKS_TO_TIMESCALE);
+// True if enough time passed since the last present.
+static bool presentDue() {
+   return SDL_GetPerformanceCounter() - lastPresent >= presentInterval;
+}
+
+// Save the frame buffer at window size (2x vertical) so the test
+// scripts see the same image dimensions as before.
+static void saveScreenshot(struct frame_buffer* fb, const char* filename) {
+   SDL_Surface *sshot = SDL_CreateRGBSurface(0, fb->width, fb->height*2,
+       32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+   for (int y = 0; y < fb->height*2; y++) {
+      memcpy((unsigned char*)sshot->pixels + y * sshot->pitch,
+             fb_line(fb, y / 2), fb->width * sizeof(unsigned int));
+   }
+   SDL_SaveBMP(sshot, filename);
+   SDL_FreeSurface(sshot);
+}
+
+// Inputs and registers we start with after reset.
+static void setDefaultState(Vtop* top) {
+   top->lp = 1;
+   top->rw = 1;
+   top->ce = 1;
+   top->lp = 1;
+   top->adl = 0;
+   top->V_DBI = 0;
+   top->V_DEN = 1;
+   top->V_CSEL = 1;
+   top->V_RSEL = 1;
+   top->V_VBORDER = 1;
+   top->V_MAIN_BORDER = 1;
+   top->V_SET_VBORDER = 1;
+   top->V_B0C = 6;
+   top->V_EC = 14;
+   top->V_VM = 1; // 0001
+   top->V_CB = 2; //  010
+   top->V_YSCROLL = 3; //  011
+#ifdef NEED_RGB
+   // Set the simulator to use the scan doubler but
+   // we are hard wired to do 2x and 1y. Any other
+   // configuration will require some work to the
+   // way rendering is done.
+   top->top__DOT__vic_inst__DOT__is_native_y = 1;
+   top->top__DOT__vic_inst__DOT__is_native_x = 0;
+#else
+   // NO RGB? We will fallback to native res and we will use
+   // the color index coming out of the pixel sequencer
+   // (pixel_color3)
+   ;
 #endif
-       next16XColClk += half16XColPS;
-       col16xtick -= 1;
+}
+
+#ifdef SIM_SAVABLE
+#define SAVE_MAGIC 0x4b415749 // KAWI
+#define SAVE_VERSION 2
+
+// Precedes the model in a state file.
+struct save_header {
+   unsigned int magic;
+   unsigned int version;
+   vluint64_t build;
+   int chip;
+   int num_clocks;
+   vluint64_t ticks;
+   int next_clk_cnt;
+};
+
+// Identifies the executable (and so the model) that wrote a state file.
+// Verilator aborts on a model mismatch so we check this first.
+static vluint64_t buildStamp() {
+   struct stat st;
+   if (stat("/proc/self/exe", &st) != 0)
+      return 0;
+   return st.st_mtime;
+}
+
+// Save the model along with our own clock bookkeeping. The signals
+// themselves are part of the model.
+static void saveState(Vtop* top, const char* filename, int chip) {
+   VerilatedSave os;
+   os.open(filename);
+   if (!os.isOpen()) {
+      LOG(LOG_ERROR, "can't save state to %s", filename);
+      return;
    }
 
-   nextClkCnt = (nextClkCnt + 1) % 32;
-   return ticks + diff1;
+   struct save_header hdr;
+   hdr.magic = SAVE_MAGIC;
+   hdr.version = SAVE_VERSION;
+   hdr.build = buildStamp();
+   hdr.chip = chip;
+   hdr.num_clocks = clocks.num;
+   hdr.ticks = ticks;
+   hdr.next_clk_cnt = nextClkCnt;
+   os.write(&hdr, sizeof(hdr));
+
+   for (int i = 0; i < clocks.num; i++) {
+      os.write(&clocks.clk[i].next_edge, sizeof(vluint64_t));
+      os.write(&clocks.clk[i].step, sizeof(int));
+   }
+
+   os << *top;
+   os.close();
+   LOG(LOG_VERBOSE, "saved state to %s", filename);
+}
+
+// Restore state saved by saveState. The file must come from the same
+// build and chip.  If keepTime is set, simulation time carries on from
+// where we are now rather than from the time the state was saved.
+// Return 1 if the file can't be used, 0 success
+static int restoreState(Vtop* top, const char* filename, int chip,
+                        bool keepTime) {
+   VerilatedRestore os;
+   os.open(filename);
+   if (!os.isOpen()) {
+      LOG(LOG_ERROR, "can't restore state from %s", filename);
+      return 1;
+   }
+
+   struct save_header hdr;
+   os.read(&hdr, sizeof(hdr));
+   if (hdr.magic != SAVE_MAGIC || hdr.version != SAVE_VERSION) {
+      LOG(LOG_ERROR, "%s is not a state file", filename);
+      return 1;
+   }
+   if (hdr.build != buildStamp()) {
+      LOG(LOG_ERROR, "%s was saved by a different build", filename);
+      return 1;
+   }
+   if (hdr.chip != chip || hdr.num_clocks != clocks.num) {
+      LOG(LOG_ERROR, "%s was saved for chip %d", filename, hdr.chip);
+      return 1;
+   }
+
+   nextClkCnt = hdr.next_clk_cnt;
+   for (int i = 0; i < clocks.num; i++) {
+      os.read(&clocks.clk[i].next_edge, sizeof(vluint64_t));
+      os.read(&clocks.clk[i].step, sizeof(int));
+      if (keepTime)
+         clocks.clk[i].next_edge = clocks.clk[i].next_edge - hdr.ticks + ticks;
+   }
+   if (!keepTime)
+      ticks = hdr.ticks;
+
+   os >> *top;
+   os.close();
+   LOG(LOG_VERBOSE, "restored state from %s", filename);
+   return 0;
+}
+
+// Snapshot cache for shadow syncs. A snapshot is taken the first tick
+// we see cycle 0 of every raster line and kept in cacheDir. A sync
+// request restores the snapshot for its raster line instead of
+// stepping up to a whole frame to get there.
+//
+// Only the VIC registers come from VICE on a sync, everything else is
+// whatever the model held when the snapshot was taken. So snapshots
+// are only good for the session that took them: names carry the
+// build, the config and our pid, and they are removed when we exit.
+#define MAX_SNAPSHOT_LINES 512
+
+static const char* cacheDir;
+static char cacheKey[64];
+static bool snapshotCached[MAX_SNAPSHOT_LINES];
+static int snapshotPrevLine = -1;
+static int snapshotPrevCycle = -1;
+
+static void snapshotFilename(char* buf, size_t len, int chip, int line) {
+   snprintf(buf, len, "%s/vicsim_%s_%d_%03d.sav", cacheDir, cacheKey,
+            chip, line);
 }
 
-static void drawPixel(SDL_Renderer* ren, int x,int y) {
-   SDL_RenderDrawPoint(ren, x,y*2);
-   SDL_RenderDrawPoint(ren, x,y*2+1);
+// Start with an empty cache. Anything under our name was left by an
+// earlier session that happened to have our pid.
+static void initSnapshots(int chip, int config) {
+   snprintf(cacheKey, sizeof(cacheKey), "%llx_%x_%d",
+            (unsigned long long) buildStamp(), config, (int) getpid());
+
+   char filename[256];
+   for (int line = 0; line < MAX_SNAPSHOT_LINES; line++) {
+      snapshotFilename(filename, sizeof(filename), chip, line);
+      unlink(filename);
+      snapshotCached[line] = false;
+   }
+}
+
+// Remove the snapshots this session took
+static void clearSnapshots(int chip) {
+   char filename[256];
+   for (int line = 0; line < MAX_SNAPSHOT_LINES; line++) {
+      if (!snapshotCached[line])
+         continue;
+      snapshotFilename(filename, sizeof(filename), chip, line);
+      unlink(filename);
+      snapshotCached[line] = false;
+   }
+}
+
+// Call after every tick.
+static void takeSnapshot(Vtop* top, int chip) {
+   int line = top->V_RASTER_LINE;
+   int cycle = top->V_CYCLE_NUM;
+   bool first = cycle == 0 &&
+       (line != snapshotPrevLine || snapshotPrevCycle != 0);
+   snapshotPrevLine = line;
+   snapshotPrevCycle = cycle;
+
+   if (!first || line >= MAX_SNAPSHOT_LINES || snapshotCached[line])
+      return;
+
+   char filename[256];
+   snapshotFilename(filename, sizeof(filename), chip, line);
+   saveState(top, filename, chip);
+   snapshotCached[line] = true;
+}
+
+// Jump to the start of the target raster line if we have it and we
+// are not already on our way there.
+static void seekSnapshot(Vtop* top, int chip, int targetLine,
+                         int targetCycle) {
+   int line = top->V_RASTER_LINE;
+   if (line == targetLine && top->V_CYCLE_NUM <= targetCycle)
+      return;
+   if (targetLine >= MAX_SNAPSHOT_LINES || !snapshotCached[targetLine])
+      return;
+
+   char filename[256];
+   snapshotFilename(filename, sizeof(filename), chip, targetLine);
+   if (restoreState(top, filename, chip, true)) {
+      // Stale; take it again on the way
+      snapshotCached[targetLine] = false;
+      return;
+   }
+
+   top->eval();
+   watch_sample();
+   STORE_PREV();
+   snapshotPrevLine = targetLine;
+   snapshotPrevCycle = 0;
+   LOG(LOG_INFO, "restored snapshot for line %d", targetLine);
+}
+#endif
+
+// What the built in CPU is doing this cycle (C64_BUS_*)
+static int c64Bus = C64_BUS_NONE;
+static int c64LastPhi = 0;
+static unsigned char c64VicData;
+
+// Drive the VIC's bus from the built in 6510 and memory. CPU accesses
+// to VIC registers use the same ce/rw timing as the VICE hook. Returns
+// true if any input changed.
+static bool c64Step(Vtop* top, struct c64* m) {
+   int adl = top->adl, dbl = top->dbl, dbh = top->dbh;
+   int ce = top->ce, rw = top->rw;
+
+   if (top->clk_phi && !c64LastPhi) {
+      c64Bus = c64_cpu_begin(m, top->aec, top->ba);
+      if (c64Bus == C64_BUS_VIC) {
+         top->adl = m->cpu.addr & 0x3f;
+         top->rw = m->cpu.rw;
+         top->ce = 0;
+      }
+   }
+   c64LastPhi = top->clk_phi;
+
+   if (top->ce == 0 && top->rw == 1)
+      c64VicData = top->V_DBO;
+
+   if (top->clk_phi == 0 && nextClkCnt == 4) {
+      c64_cpu_end(m, c64Bus, c64VicData, top->irq);
+      c64Bus = C64_BUS_NONE;
+      top->ce = 1;
+      top->rw = 1;
+   }
+
+   // A CPU write to the VIC owns the data bus. Otherwise the VIC sees
+   // memory at whatever address it is putting out.
+   if (top->ce == 0 && top->rw == 0) {
+      top->dbl = m->cpu.data;
+   } else {
+      unsigned short v = c64_vic_fetch(m, top->V_VICADDR);
+      top->dbl = v & 0xff;
+      top->dbh = v >> 8;
+   }
+
+   return adl != top->adl || dbl != top->dbl || dbh != top->dbh ||
+      ce != top->ce || rw != top->rw;
+}
+
+// Load the bus inputs of a batch entry as if VICE had sent them.
+static void batchLoad(struct vicii_state* state, struct vicii_batch_in* in) {
+   state->addr_to_sim = in->addr_to_sim;
+   state->data_to_sim = in->data_to_sim;
+   state->ce = in->ce;
+   state->rw = in->rw;
+   state->lp = in->lp;
+   state->flags = (state->flags & ~VICII_OP_BUS_ACCESS) |
+      (in->flags & VICII_OP_BUS_ACCESS);
+}
+
+// Record our outputs for a batch entry. Returns the checked fields
+// that don't match what VICE expected.
+static unsigned int batchStore(struct vicii_state* state,
+                               struct vicii_batch_in* in,
+                               struct vicii_batch_out* out) {
+   out->irq = state->irq;
+   out->ba = state->ba;
+   out->aec = state->aec;
+   out->phi = state->phi;
+   out->addr_from_sim = state->addr_from_sim;
+   out->data_from_sim = state->data_from_sim;
+   out->cycle_num = state->cycle_num;
+   out->raster_line = state->raster_line;
+   out->xpos = state->xpos;
+   memcpy(out->fpga_reg, state->fpga_reg, sizeof(out->fpga_reg));
+
+   unsigned int bad = 0;
+   if ((in->check & BATCH_CHECK_IRQ) && in->irq != out->irq)
+      bad |= BATCH_CHECK_IRQ;
+   if ((in->check & BATCH_CHECK_BA) && in->ba != out->ba)
+      bad |= BATCH_CHECK_BA;
+   if ((in->check & BATCH_CHECK_AEC) && in->aec != out->aec)
+      bad |= BATCH_CHECK_AEC;
+   if ((in->check & BATCH_CHECK_ADDR) && in->addr_from_sim != out->addr_from_sim)
+      bad |= BATCH_CHECK_ADDR;
+   if ((in->check & BATCH_CHECK_DATA) && in->data_from_sim != out->data_from_sim)
+      bad |= BATCH_CHECK_DATA;
+   return bad;
 }
 
 // Initial sync
@@ -465,119 +831,234 @@ static void regs_vice_to_fpga(Vtop* top, struct vicii_state* state) {
        }
 }
 
-static void regs_fpga_to_vice(Vtop* top, struct vicii_state* state) {
-       state->fpga_reg[0x11] =
-          (top->V_YSCROLL & 0x7) |
+// Step forward until we get to the target cycle/line/phase.
+// rasterline and when dot4x just ticked low (we always tick into high
+// when beginning to step so we must leave dot4x low. We
+// don't have to worry about going over the last xpos or
+// the repeats on the R8 because the VICE sync won't attempt
+// a sync past xpos 0x17c.  Then load VICE's registers.
+static void syncToState(Vtop* top, struct vicii_state* state, int chip) {
+   // nextTick() evaluates every edge so we only need to
+   // evaluate once before we start.
+   top->eval();
+#ifdef SIM_SAVABLE
+   if (cacheDir)
+      seekSnapshot(top, chip, state->raster_line, state->cycle_num);
+#endif
+   while (true) {
+      if (top->V_CYCLE_NUM == state->cycle_num &&
+             top->V_RASTER_LINE == state->raster_line &&
+             top->clk_phi) break;
+
+      ticks = nextTick(top);
+#ifdef SIM_SAVABLE
+      if (cacheDir)
+         takeSnapshot(top, chip);
+#endif
+      watch_sample();
+      STATE(top);
+      STORE_PREV();
+   }
+
+   // Now 3 more ticks + 1 more from leaving this block
+   // and we will land one 'step' into our target cycle.
+   for (int i=0; i< 3; i++) {
+      ticks = nextTick(top);
+      watch_sample();
+      STATE(top);
+      STORE_PREV();
+   }
+
+   regs_vice_to_fpga(top, state);
+
+   // Our next tick will bring us high so we should be low right now.
+   CHECK(top, ~top->clk_phi, __LINE__);
+
+   LOG(LOG_INFO, "synced FPGA to cycle=%u, raster_line=%u, xpos=%03x, bmm=%d, mcm=%d, ecm=%d",
+      state->cycle_num, state->raster_line, state->xpos, top->V_BMM, top->V_MCM, top->V_ECM);
+}
+
+// Store a field and note any bits that changed in diff
+#define PUT(diff, field, value) do { \
+      unsigned int old_ = state->field; \
+      state->field = (value); \
+      diff |= old_ ^ state->field; \
+   } while (0)
+
+// Read all our registers into state. Returns the VICII_DIRTY_* groups
+// whose contents changed.
+static unsigned int read_fpga_regs(Vtop* top, struct vicii_state* state) {
+       unsigned int regs = 0, matrix = 0, sprites = 0, chars = 0;
+
+       PUT(regs, fpga_reg[0x11], (top->V_YSCROLL & 0x7) |
           (top->V_RSEL ? 8 : 0) |
           (top->V_DEN  ? 16 : 0) |
           (top->V_BMM  ? 32 : 0) |
           (top->V_ECM  ? 64 : 0) |
-          ((top->V_RASTER_LINE_D & 256) ? 128 : 0);
+          ((top->V_RASTER_LINE_D & 256) ? 128 : 0));
 
-       state->fpga_reg[0x12] =
-          top->V_RASTER_LINE_D & 0xff;
+       PUT(regs, fpga_reg[0x12], top->V_RASTER_LINE_D & 0xff);
 
-       state->fpga_reg[0x13] = top->V_LPX;
-       state->fpga_reg[0x14] = top->V_LPY;
+       PUT(regs, fpga_reg[0x13], top->V_LPX);
+       PUT(regs, fpga_reg[0x14], top->V_LPY);
 
-       state->fpga_reg[0x16] =
-          (top->V_XSCROLL & 0x7) |
+       PUT(regs, fpga_reg[0x16], (top->V_XSCROLL & 0x7) |
           (top->V_CSEL ? 8 : 0) |
           (top->V_MCM ? 16 : 0) |
           (top->V_RES ? 32 : 0) |
-          0b11000000;
+          0b11000000);
 
-       state->fpga_reg[0x18] = 1 |
+       PUT(regs, fpga_reg[0x18], 1 |
           ((top->V_CB & 0x7) << 1) |
-          ((top->V_VM & 0xf) << 4);
+          ((top->V_VM & 0xf) << 4));
 
-       state->fpga_reg[0x19] =
-	  (top->V_IRQ ? 128 : 0) |
+       PUT(regs, fpga_reg[0x19], (top->V_IRQ ? 128 : 0) |
           (top->V_IRST ? 1 : 0) |
           (top->V_IMBC ? 2 : 0) |
           (top->V_IMMC ? 4 : 0) |
           (top->V_ILP ? 8 : 0) |
-          0b01110000;
+          0b01110000);
 
-       state->fpga_reg[0x1A] =
-          (top->V_ERST  ? 1 : 0) |
+       PUT(regs, fpga_reg[0x1A], (top->V_ERST  ? 1 : 0) |
           (top->V_EMBC  ? 2 : 0) |
           (top->V_EMMC  ? 4 : 0) |
           (top->V_ELP   ? 8 : 0) |
-          0b11110000;
-
-       state->fpga_reg[0x20] =
-          (top->V_EC & 15) | 0b11110000;
-       state->fpga_reg[0x21] =
-          (top->V_B0C & 15) | 0b11110000;
-       state->fpga_reg[0x22] =
-          (top->V_B1C & 15) | 0b11110000;
-       state->fpga_reg[0x23] =
-          (top->V_B2C & 15) | 0b11110000;
-       state->fpga_reg[0x24] =
-          (top->V_B3C & 15) | 0b11110000;
-
-       state->vc = top->V_VC;
-       state->vc_base = top->V_VCBASE;
-       state->rc = top->V_RC;
-
-       state->allow_bad_lines = top->V_ALLOW_BAD_LINES;
-       state->reg11_delayed = top->V_REG11_DELAYED;
-
-       state->fpga_reg[0x00] = top->V_SPRITE_X[0] & 0xff;
-       state->fpga_reg[0x01] = top->V_SPRITE_Y[0];
-       state->fpga_reg[0x02] = top->V_SPRITE_X[1] & 0xff;
-       state->fpga_reg[0x03] = top->V_SPRITE_Y[1];
-       state->fpga_reg[0x04] = top->V_SPRITE_X[2] & 0xff;
-       state->fpga_reg[0x05] = top->V_SPRITE_Y[2];
-       state->fpga_reg[0x06] = top->V_SPRITE_X[3] & 0xff;
-       state->fpga_reg[0x07] = top->V_SPRITE_Y[3];
-       state->fpga_reg[0x08] = top->V_SPRITE_X[4] & 0xff;
-       state->fpga_reg[0x09] = top->V_SPRITE_Y[4];
-       state->fpga_reg[0x0a] = top->V_SPRITE_X[5] & 0xff;
-       state->fpga_reg[0x0b] = top->V_SPRITE_Y[5];
-       state->fpga_reg[0x0c] = top->V_SPRITE_X[6] & 0xff;
-       state->fpga_reg[0x0d] = top->V_SPRITE_Y[6];
-       state->fpga_reg[0x0e] = top->V_SPRITE_X[7] & 0xff;
-       state->fpga_reg[0x0f] = top->V_SPRITE_Y[7];
-       state->fpga_reg[0x10] = ((top->V_SPRITE_X[0] & 256) >> 8) |
+          0b11110000);
+
+       PUT(regs, fpga_reg[0x20], (top->V_EC & 15) | 0b11110000);
+       PUT(regs, fpga_reg[0x21], (top->V_B0C & 15) | 0b11110000);
+       PUT(regs, fpga_reg[0x22], (top->V_B1C & 15) | 0b11110000);
+       PUT(regs, fpga_reg[0x23], (top->V_B2C & 15) | 0b11110000);
+       PUT(regs, fpga_reg[0x24], (top->V_B3C & 15) | 0b11110000);
+
+       PUT(matrix, vc, top->V_VC);
+       PUT(matrix, vc_base, top->V_VCBASE);
+       PUT(matrix, rc, top->V_RC);
+
+       PUT(matrix, allow_bad_lines, top->V_ALLOW_BAD_LINES);
+       PUT(matrix, reg11_delayed, top->V_REG11_DELAYED);
+
+       PUT(regs, fpga_reg[0x00], top->V_SPRITE_X[0] & 0xff);
+       PUT(regs, fpga_reg[0x01], top->V_SPRITE_Y[0]);
+       PUT(regs, fpga_reg[0x02], top->V_SPRITE_X[1] & 0xff);
+       PUT(regs, fpga_reg[0x03], top->V_SPRITE_Y[1]);
+       PUT(regs, fpga_reg[0x04], top->V_SPRITE_X[2] & 0xff);
+       PUT(regs, fpga_reg[0x05], top->V_SPRITE_Y[2]);
+       PUT(regs, fpga_reg[0x06], top->V_SPRITE_X[3] & 0xff);
+       PUT(regs, fpga_reg[0x07], top->V_SPRITE_Y[3]);
+       PUT(regs, fpga_reg[0x08], top->V_SPRITE_X[4] & 0xff);
+       PUT(regs, fpga_reg[0x09], top->V_SPRITE_Y[4]);
+       PUT(regs, fpga_reg[0x0a], top->V_SPRITE_X[5] & 0xff);
+       PUT(regs, fpga_reg[0x0b], top->V_SPRITE_Y[5]);
+       PUT(regs, fpga_reg[0x0c], top->V_SPRITE_X[6] & 0xff);
+       PUT(regs, fpga_reg[0x0d], top->V_SPRITE_Y[6]);
+       PUT(regs, fpga_reg[0x0e], top->V_SPRITE_X[7] & 0xff);
+       PUT(regs, fpga_reg[0x0f], top->V_SPRITE_Y[7]);
+       PUT(regs, fpga_reg[0x10], ((top->V_SPRITE_X[0] & 256) >> 8) |
                                ((top->V_SPRITE_X[1] & 256) >> 7) |
                                ((top->V_SPRITE_X[2] & 256) >> 6) |
                                ((top->V_SPRITE_X[3] & 256) >> 5) |
                                ((top->V_SPRITE_X[4] & 256) >> 4) |
                                ((top->V_SPRITE_X[5] & 256) >> 3) |
                                ((top->V_SPRITE_X[6] & 256) >> 2) |
-                               ((top->V_SPRITE_X[7] & 256) >> 1);
-
-       state->fpga_reg[0x15] = top->V_SPRITE_EN;
-       state->fpga_reg[0x17] = top->V_SPRITE_YE;
-       state->fpga_reg[0x1b] = top->V_SPRITE_PRI;
-       state->fpga_reg[0x1c] = top->V_SPRITE_MMC;
-       state->fpga_reg[0x1d] = top->V_SPRITE_XE;
-       state->fpga_reg[0x1e] = top->V_SPRITE_M2M;
-       state->fpga_reg[0x1f] = top->V_SPRITE_M2D;
-       state->fpga_reg[0x25] = top->V_SPRITE_MC0 | 0xf0;
-       state->fpga_reg[0x26] = top->V_SPRITE_MC1 | 0xf0;
+                               ((top->V_SPRITE_X[7] & 256) >> 1));
+
+       PUT(regs, fpga_reg[0x15], top->V_SPRITE_EN);
+       PUT(regs, fpga_reg[0x17], top->V_SPRITE_YE);
+       PUT(regs, fpga_reg[0x1b], top->V_SPRITE_PRI);
+       PUT(regs, fpga_reg[0x1c], top->V_SPRITE_MMC);
+       PUT(regs, fpga_reg[0x1d], top->V_SPRITE_XE);
+       PUT(regs, fpga_reg[0x1e], top->V_SPRITE_M2M);
+       PUT(regs, fpga_reg[0x1f], top->V_SPRITE_M2D);
+       PUT(regs, fpga_reg[0x25], top->V_SPRITE_MC0 | 0xf0);
+       PUT(regs, fpga_reg[0x26], top->V_SPRITE_MC1 | 0xf0);
 
        for (int n=0,b=1;n<8;n++,b=b*2) {
-          state->mc[n] = top->V_SPRITE_MC[n];
-          state->mcbase[n] = top->V_SPRITE_MCBASE[n];
-          state->ye_ff[n] = top->V_SPRITE_YE_FF[n];
-          state->sprite_dma[n] = top->V_SPRITE_DMA & b ? 1 : 0;
-          state->fpga_reg[0x27+n] = top->V_SPRITE_COL[n] | 0xf0;
+          PUT(sprites, mc[n], top->V_SPRITE_MC[n]);
+          PUT(sprites, mcbase[n], top->V_SPRITE_MCBASE[n]);
+          PUT(sprites, ye_ff[n], top->V_SPRITE_YE_FF[n]);
+          PUT(sprites, sprite_dma[n], top->V_SPRITE_DMA & b ? 1 : 0);
+          PUT(regs, fpga_reg[0x27+n], top->V_SPRITE_COL[n] | 0xf0);
        }
 
        // Tell VICE what our char buf looks like or comparison
        for (int i=0; i < 40; i++) {
-	  state->fpga_char_buf[i] = top->V_CHAR_BUF[i];
+	  PUT(chars, fpga_char_buf[i], top->V_CHAR_BUF[i]);
        }
+
+       return (regs ? VICII_DIRTY_REGS : 0) |
+              (matrix ? VICII_DIRTY_MATRIX : 0) |
+              (sprites ? VICII_DIRTY_SPRITES : 0) |
+              (chars ? VICII_DIRTY_CHAR_BUF : 0);
 }
 
+// Hand our registers to VICE and flag the groups we changed
+static void regs_fpga_to_vice(Vtop* top, struct vicii_state* state) {
+   state->dirty |= read_fpga_regs(top, state);
+}
+
+
+// Parse a -F feature list, i.e. "ext,math" or "all", into a
+// sim_features mask. Returns -1 on error.
+static int parseFeatures(const char* arg) {
+   static const struct { const char* name; int mask; } names[] = {
+      { "none", 0 },
+      { "all", FEATURE_ALL },
+      { "ext", FEATURE_EXTENSIONS },
+      { "math", FEATURE_MATH | FEATURE_EXTENSIONS },
+      { "hires", FEATURE_HIRES | FEATURE_EXTENSIONS },
+      { "blitter", FEATURE_BLITTER | FEATURE_EXTENSIONS },
+   };
+   char buf[128];
+   int mask = 0;
+   snprintf(buf, sizeof(buf), "%s", arg);
+   for (char* tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+      unsigned i;
+      for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+         if (strcmp(tok, names[i].name) == 0) {
+            mask |= names[i].mask;
+            break;
+         }
+      }
+      if (i == sizeof(names) / sizeof(names[0]))
+         return -1;
+   }
+   return mask;
+}
 
 int main(int argc, char** argv, char** env) {
     SDL_Event event;
     SDL_Renderer* ren = nullptr;
+    SDL_Texture* tex = nullptr;
     SDL_Window* win;
+    struct frame_buffer* fb = nullptr;
+    const char* framePattern = nullptr;
+    long maxFrames = -1;
+    bool benchmark = false;
+    const char* saveFile = nullptr;
+    const char* restoreFile = nullptr;
+    const char* snapshotDir = nullptr;
+    const char* ipcName = nullptr;
+    const char* recordFile = nullptr;
+    const char* replayFile = nullptr;
+    struct stimulus* stimRec = nullptr;
+    struct stimulus* stimPlay = nullptr;
+    long replayMismatches = 0;
+    const char* prgFile = nullptr;
+    const char* romDir = nullptr;
+    const char* vsfFile = nullptr;
+    const char* benchName = nullptr;
+    struct c64* c64 = nullptr;
+    const char* hashFile = nullptr;
+    const char* goldenFile = nullptr;
+    const char* testName = nullptr;
+    FILE* hashOut = nullptr;
+    struct hash_manifest* golden = nullptr;
+    struct frame_hash frameHash = { 0, 0, nullptr };
+    long hashMismatches = 0;
+    int simFeatures = FEATURE_ALL;
+    int hashConfig = SIM_CONFIG_ID;
+    double benchStart = 0;
 
     struct vicii_state* state;
     bool capture = false;
@@ -597,8 +1078,14 @@ int main(int argc, char** argv, char** env) {
     int cycleByCycleCount = 0;
     int last_phase = 0;
     bool tracing = false;
+    struct trace_trigger traceStart = { TRIG_NONE };
+    struct trace_trigger traceStop = { TRIG_NONE };
+    long tracePreCycles = 0;
+    char* stateLogFile = nullptr;
+    char* statsFile = nullptr;
+    uint64_t stateLogRecords = STATELOG_RECORDS;
     int prevY = -1;
-    struct vicii_ipc* ipc;
+    struct vicii_ipc* ipc = nullptr;
     bool keyPressToQuit = true;
     bool viceCapture = false;
     bool scanline = true;
@@ -615,16 +1102,110 @@ int main(int argc, char** argv, char** env) {
     int reti, reti2;
     char regex_buf[32];
 
-    while ((c = getopt (argc, argv, "akc:hs:d:wi:zbl:r:gtxq")) != -1)
+    while ((c = getopt (argc, argv, "akc:hs:d:wi:zbl:r:gtxqo:n:BS:R:C:I:p:P:K:V:H:G:N:F:T:U:Y:L:j:M:")) != -1)
     switch (c) {
+      case 'o':
+        framePattern = optarg;
+        break;
+      case 'n':
+        maxFrames = atol(optarg);
+        break;
+      case 'B':
+        benchmark = true;
+        break;
+      case 'S':
+        saveFile = optarg;
+        break;
+      case 'R':
+        restoreFile = optarg;
+        break;
+      case 'C':
+        snapshotDir = optarg;
+        break;
+      case 'I':
+        ipcName = optarg;
+        break;
+      case 'P':
+        prgFile = optarg;
+        break;
+      case 'K':
+        romDir = optarg;
+        break;
+      case 'V':
+        vsfFile = optarg;
+        break;
+      case 'M':
+        benchName = optarg;
+        break;
+      case 'H':
+        hashFile = optarg;
+        break;
+      case 'G':
+        goldenFile = optarg;
+        break;
+      case 'N':
+        testName = optarg;
+        break;
+      case 'F':
+#if SIM_FEATURES
+        simFeatures = parseFeatures(optarg);
+        if (simFeatures < 0) {
+           LOG(LOG_ERROR, "bad feature list %s", optarg);
+           exit(-1);
+        }
+#else
+        LOG(LOG_ERROR, "-F needs a superset model (make SIM_CONFIG=11)");
+        exit(-1);
+#endif
+        break;
+      case 'r':
+        recordFile = optarg;
+        break;
+      case 'p':
+        // Drive the model from a recording instead of VICE
+        replayFile = optarg;
+        captureByTime = false;
+        shadowVic = true;
+        break;
       case 'q':
         scanline = false;
+        // Falls through, -q has always turned on tracing too
+        // (test_all.sh relies on it)
       case 't':
         tracing = true;
         break;
+      case 'T':
+      case 'U':
+        if (trace_parse_trigger(optarg, c == 'T' ? &traceStart : &traceStop) ||
+               (c == 'T' && traceStart.type == TRIG_CYCLES) ||
+               (c == 'U' && traceStop.type == TRIG_CHECK)) {
+           LOG(LOG_ERROR, "bad trace trigger %s", optarg);
+           exit(-1);
+        }
+        tracing = true;
+        break;
+      case 'Y':
+        tracePreCycles = atol(optarg);
+        tracing = true;
+        break;
       case 'l':
         logLevel = atoi(optarg);
         break;
+      case 'j':
+        statsFile = optarg;
+        break;
+      case 'L':
+        stateLogFile = optarg;
+        token = strchr(optarg, ':');
+        if (token) {
+           *token = '\0';
+           stateLogRecords = atol(token + 1);
+           if (stateLogRecords == 0) {
+              LOG(LOG_ERROR, "bad state log size %s", token + 1);
+              exit(-1);
+           }
+        }
+        break;
       case 'c':
         chip = atoi(optarg);
         break;
@@ -660,10 +1241,43 @@ int main(int argc, char** argv, char** env) {
         printf ("  -b        : render each cycle, waiting for key press after each one\n");
         printf ("  -c <chip> : 0=CHIP6567R8, 1=CHIP6569R3 2=CHIP6567R56A 3=CHIP6569R1\n");
         printf ("  -l        : log level\n");
+        printf ("  -L <file>[:<num>] : log the last num half cycle states\n");
+        printf ("              (default %d) in binary, see statedump\n",
+                STATELOG_RECORDS);
         printf ("  -q        : hide scanline\n");
         printf ("  -k        : hide sync lines\n");
-        printf ("  -t        : enable tracing to session.vcd\n");
+        printf ("  -t        : enable tracing to %s\n", TRACE_FILE);
+        printf ("  -T <trig> : start tracing on trigger line:<n>[:<cycle>],\n");
+        printf ("              write:<reg>, irq or check\n");
+        printf ("  -U <trig> : stop tracing on trigger (same) or +<cycles>\n");
+        printf ("  -Y <num>  : keep num cycles before the start trigger\n");
         printf ("  -x        : sync with VICE and save a frame before exiting\n");
+        printf ("  -o <file> : write each complete frame as PPM (%%d = frame num)\n");
+        printf ("  -n <num>  : stop after num complete frames\n");
+        printf ("  -B        : report simulated frames per second (default -n 3)\n");
+        printf ("  -j <file> : report where time goes every %ds and at exit,\n",
+                STATS_INTERVAL);
+        printf ("              totals as JSON to file (- for stdout)\n");
+        printf ("  -S <file> : save simulator state to file when done\n");
+        printf ("  -R <file> : restore simulator state from file instead of reset\n");
+        printf ("  -C <dir>  : cache raster line snapshots in dir for fast VICE sync\n");
+        printf ("  -I <name> : IPC endpoint name (default $VICII_IPC_NAME)\n");
+        printf ("  -r <file> : record the steps VICE sends to file (with -z)\n");
+        printf ("  -p <file> : replay recorded steps and check our outputs\n");
+        printf ("  -P <prg>  : run prg on the built in 6510 instead of VICE\n");
+        printf ("  -K <dir>  : basic, kernal and chargen roms for -P/-V\n");
+        printf ("  -V <file> : start from a VICE .vsf snapshot instead of VICE\n");
+        printf ("  -M <name> : run a canned bench scenario on the built in 6510,\n");
+        printf ("              one of");
+        for (int i = 0; bench_scenarios[i]; i++)
+           printf (" %s", bench_scenarios[i]);
+        printf ("\n");
+        printf ("  -H <file> : write frame and line hashes to file\n");
+        printf ("  -G <file> : compare frame hashes with a golden manifest, with\n");
+        printf ("              -o only frames that differ are written\n");
+        printf ("  -N <name> : test name for -H/-G (default prg/vsf file name)\n");
+        printf ("  -F <list> : features of a superset model to enable, any of\n");
+        printf ("              ext,math,hires,blitter or all/none (default all)\n");
         exit(0);
       case 'x':
 	viceCapture = true;
@@ -681,26 +1295,110 @@ int main(int argc, char** argv, char** env) {
         exit(-1);
     }
 
-    int sdl_init_mode = SDL_INIT_VIDEO;
-    if (SDL_Init(sdl_init_mode) != 0) {
-      LOG(LOG_ERROR, "SDL_Init %s", SDL_GetError());
-      return 1;
+    if (benchmark && maxFrames <= 0) {
+       maxFrames = 3;
+    }
+
+    if (recordFile && (!shadowVic || replayFile)) {
+       LOG(LOG_ERROR, "-r records from VICE and needs -z");
+       exit(-1);
+    }
+
+    if ((prgFile || vsfFile || benchName) && shadowVic) {
+       LOG(LOG_ERROR, "-P, -V and -M can't be used while shadowing VICE");
+       exit(-1);
+    }
+
+    if ((prgFile != nullptr) + (vsfFile != nullptr) + (benchName != nullptr) > 1) {
+       LOG(LOG_ERROR, "use one of -P, -V or -M");
+       exit(-1);
+    }
+
+    if (replayFile) {
+       stimPlay = stim_replay(replayFile);
+       if (!stimPlay)
+          exit(-1);
+       chip = stimPlay->chip;
+    }
+
+#if SIM_FEATURES
+    // Each feature set of a superset model hashes as its own config
+    hashConfig = SIM_CONFIG_ID * 16 + simFeatures;
+#endif
+
+    if (hashFile || goldenFile) {
+       if (!testName) {
+          const char* file = prgFile ? prgFile : vsfFile ? vsfFile :
+                                benchName ? benchName : "vicsim";
+          testName = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+       }
+       if (hashFile) {
+          hashOut = fopen(hashFile, "w");
+          if (!hashOut) {
+             LOG(LOG_ERROR, "can't write %s", hashFile);
+             exit(-1);
+          }
+       }
+       if (goldenFile) {
+          golden = fh_load_manifest(goldenFile, testName, chip, hashConfig);
+          if (!golden)
+             exit(-1);
+       }
+    }
+
+#ifndef SIM_SAVABLE
+    if (saveFile || restoreFile || snapshotDir) {
+       LOG(LOG_ERROR, "state save/restore needs a savable build (make SAVABLE=1)");
+       exit(-1);
+    }
+#endif
+
+    // Only the window needs a display. Frames for the file sink and
+    // screenshots are rendered into our own frame buffer.
+    if (showWindow) {
+      int sdl_init_mode = SDL_INIT_VIDEO;
+      if (SDL_Init(sdl_init_mode) != 0) {
+        LOG(LOG_ERROR, "SDL_Init %s", SDL_GetError());
+        return 1;
+      }
+    }
+
+    // Without the ring there is nothing from before the failed CHECK
+    // to write and nothing after it either
+    if (traceStart.type == TRIG_CHECK) {
+#if VM_TRACE_FST
+       LOG(LOG_ERROR, "-T check needs a VCD build");
+       exit(-1);
+#endif
+       if (tracePreCycles <= 0) {
+          LOG(LOG_ERROR, "-T check needs -Y <cycles>");
+          exit(-1);
+       }
     }
 
     // Add new input/output here.
     Vtop* top = new Vtop;
 
+#if !VM_TRACE
+    if (tracing)
+        LOG(LOG_WARN, "model built without --trace, not tracing");
+#endif
+
 #if VM_TRACE
-    VerilatedVcdC* tfp = NULL;
     if (tracing) {
-        Verilated::traceEverOn(true);  // Verilator must compute traced signals
-        VL_PRINTF("verilog tracing into session.vcd\n");
-        tfp = new VerilatedVcdC;
-        top->trace(tfp, 99);  // Trace 99 levels of hierarchy
-        tfp->open("session.vcd");  // Open the dump file
+        trace_open(top, TRACE_FILE, traceStart.type ? &traceStart : nullptr,
+                   traceStop.type ? &traceStop : nullptr, tracePreCycles);
     }
 #endif
 
+    if (stateLogFile) {
+        if (statelog_open(stateLogFile, stateLogRecords)) {
+           LOG(LOG_ERROR, "can't create state log %s", stateLogFile);
+           exit(-1);
+        }
+        stateLogging = true;
+    }
+
     top->eval();
 
     switch (chip) {
@@ -762,6 +1460,12 @@ int main(int argc, char** argv, char** env) {
        durationTicks = US_TO_TICKS(userDurationUs);
     }
 
+    // When asked for a number of frames, let the frame count decide
+    // when we stop unless a duration was also given.
+    if (maxFrames > 0 && userDurationUs == -1) {
+       durationTicks = ~0ULL / 2;
+    }
+
     if (isNtsc) {
        half4XDotPS = NTSC_HALF_4X_DOT_PS;
        half16XColPS = NTSC_HALF_16X_COLOR_PS;
@@ -799,7 +1503,21 @@ int main(int argc, char** argv, char** env) {
        }
     }
 
-    nextClk = half4XDotPS;
+    // dot4x and col4x always toggle together. Edges that coincide are
+    // merged into one eval by the scheduler.
+    clocks_init(&clocks);
+    dot4xClock = clocks_add(&clocks, &top->V_DOT4X, half4XDotPS,
+                            CLOCK_GATE_ALL);
+    clocks_add(&clocks, &top->V_COL4X, half4XDotPS, CLOCK_GATE_ALL);
+#if HAVE_COL16X
+    clocks_add(&clocks, &top->V_COL16X, half16XColPS, CLOCK_GATE_ALL);
+#endif
+#ifdef EFINIX
+#ifdef WITH_DVI
+    clocks_add(&clocks, &top->V_CLK_DVI, half4XDotPS,
+               (chip & 1) ? DVI_GATE_PAL : DVI_GATE_NTSC);
+#endif
+#endif
 
     if (showWindow) {
       SDL_DisplayMode current;
@@ -814,8 +1532,9 @@ int main(int argc, char** argv, char** env) {
         return 1;
       }
 
-      ren = SDL_CreateRenderer(
-          win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+      // No vsync; presents are throttled by us so the simulation
+      // never blocks waiting for the display.
+      ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
       if (ren == nullptr) {
         std::cerr << "SDL_CreateRenderer Error: "
            << SDL_GetError() << std::endl;
@@ -823,19 +1542,45 @@ int main(int argc, char** argv, char** env) {
         SDL_Quit();
         return 1;
       }
+
+      tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ARGB8888,
+                              SDL_TEXTUREACCESS_STREAMING,
+                              screenWidth*2, screenHeight);
+      if (tex == nullptr) {
+        std::cerr << "SDL_CreateTexture Error: "
+           << SDL_GetError() << std::endl;
+        SDL_DestroyRenderer(ren);
+        SDL_DestroyWindow(win);
+        SDL_Quit();
+        return 1;
+      }
+
+      SDL_RenderSetScale(ren, 1, 2);
+
+      int refreshRate = 60;
+      if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(win),
+                                    &current) == 0 &&
+             current.refresh_rate > 0)
+        refreshRate = current.refresh_rate;
+      presentInterval = SDL_GetPerformanceFrequency() / refreshRate;
     }
 
-    // Default all signals to bit 1 and include in monitoring.
-    for (int i = 0; i < NUM_SIGNALS; i++) {
-      signal_width[i] = 1;
-      signal_bit[i] = 1;
+    // We render whenever something wants to see pixels.
+    bool render = showWindow || framePattern != nullptr || viceCapture ||
+                  hashOut || golden;
+    if (render) {
+      fb = fb_init(screenWidth*2, screenHeight);
     }
+    // True once the frame buffer holds a frame drawn from line 0
+    bool fullFrame = false;
 
     // Add new input/output here.
-    signal_src8[OUT_DOT] = &top->V_CLK_DOT;
-    signal_src8[OUT_DOT_RISING] = &top->V_CLK_DOT;
-    signal_width[OUT_DOT_RISING] = 4; // 4 bit shif reg
-    signal_bit[OUT_DOT_RISING] = 0b1111; // mask to get values
+    watch_add(OUT_DOT, &top->V_CLK_DOT, 0b0001);
+    watch_add(OUT_DOT_RISING, &top->V_CLK_DOT, 0b1111); // 4 bit shift reg
+
+    // Timing checks while capturing
+    struct dot_checks dotChecks = { top, chip, &capture };
+    watch_on(OUT_DOT, WATCH_RISE, checkDotRise, &dotChecks);
 
     HEADER(top);
 
@@ -850,6 +1595,9 @@ int main(int argc, char** argv, char** env) {
     top->cfg1 = 0; // spi_lock
     top->cfg2 = 0; // extensions_lock
     top->cfg3 = 0; // persistence_lock
+#endif
+#if SIM_FEATURES
+    top->sim_features = simFeatures;
 #endif
     // cpu_reset_i is held HIGH simulating pullup
 #if HIRES_RESET
@@ -858,69 +1606,91 @@ int main(int argc, char** argv, char** env) {
     
     top->V_CHIP = chip;
 
-    int cnt = 0;
-    while (top->V_RST) {
+    if (restoreFile) {
+#ifdef SIM_SAVABLE
+       // Pick up where a previous run left off. This skips reset.
+       if (restoreState(top, restoreFile, chip, false))
+          exit(-1);
+#endif
+    } else {
+       int cnt = 0;
        top->eval();
-       nextClkCnt = 0;
 #if VM_TRACE
-       if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
+       trace_dump(ticks / TICKS_TO_TIMESCALE);
 #endif
-       STATE(top);
-       STORE_PREV();
-       ticks = nextTick(top, tfp, chip);
-       cnt++;
-    }
+       while (top->V_RST) {
+          nextClkCnt = 0;
+          watch_sample();
+          STATE(top);
+          STORE_PREV();
+          ticks = nextTick(top);
+          cnt++;
+       }
 
-    // Not sure if this matters anymore
-    nextClkCnt = 31;
+       // Not sure if this matters anymore
+       nextClkCnt = 31;
+    }
 
     // Start counting from after reset
     startTicks = ticks;
+    if (statsFile)
+       stats_init(statsFile);
     endTicks = startTicks + durationTicks;
 
-    top->lp = 1;
-    top->rw = 1;
-    top->ce = 1;
-    top->lp = 1;
-    top->adl = 0;
-    top->V_DBI = 0;
-    top->V_DEN = 1;
-    top->V_CSEL = 1;
-    top->V_RSEL = 1;
-    top->V_VBORDER = 1;
-    top->V_MAIN_BORDER = 1;
-    top->V_SET_VBORDER = 1;
-    top->V_B0C = 6;
-    top->V_EC = 14;
-    top->V_VM = 1; // 0001
-    top->V_CB = 2; //  010
-    top->V_YSCROLL = 3; //  011
-#ifdef NEED_RGB
-    // Set the simulator to use the scan doubler but
-    // we are hard wired to do 2x and 1y. Any other
-    // configuration will require some work to the
-    // way rendering is done.
-    top->top__DOT__vic_inst__DOT__is_native_y = 1;
-    top->top__DOT__vic_inst__DOT__is_native_x = 0;
-#else
-    // NO RGB? We will fallback to native res and we will use
-    // the color index coming out of the pixel sequencer
-    // (pixel_color3)
-    ;
-#endif
+    if (restoreFile == nullptr)
+       setDefaultState(top);
 
-    if (shadowVic) {
-       ipc = ipc_init(IPC_RECEIVER);
+    if (stimPlay) {
+       state = (struct vicii_state*) calloc(1, sizeof(struct vicii_state));
+    } else if (shadowVic) {
+       if (ipcName)
+          ipc = ipc_init_named(IPC_RECEIVER, ipcName);
+       else
+          ipc = ipc_init(IPC_RECEIVER);
        ipc_open(ipc);
        state = ipc->state;
     }
 
+    if (recordFile) {
+       stimRec = stim_record(recordFile, chip);
+       if (!stimRec)
+          exit(-1);
+    }
+
+    if (prgFile || vsfFile || benchName) {
+       c64 = c64_init(romDir, isNtsc);
+       if (prgFile && c64_load_prg(c64, prgFile))
+          exit(-1);
+       if (benchName && bench_load(c64, benchName))
+          exit(-1);
+       if (vsfFile) {
+          // Same as a VICE sync request, then carry on from there
+          struct vicii_state snap;
+          if (vsf_load(vsfFile, &snap, c64))
+             exit(-1);
+          syncToState(top, &snap, chip);
+       }
+       c64LastPhi = top->clk_phi;
+    }
+
+#ifdef SIM_SAVABLE
+    if (snapshotDir && shadowVic) {
+       cacheDir = snapshotDir;
+       initSnapshots(chip, hashConfig);
+    }
+#endif
+
     // IMPORTANT: Any and all state reads/writes MUST occur between ipc_receive
     // and ipc_receive_done inside this loop.
     int ticksUntilDone = 0;
+    unsigned int batchIndex = 0;
     int ticksUntilPhase = 0;
     bool showState = true;
     bool viceCaptureWaitLine1 = true;
+    bool stopRequested = false;
+    long numFrames = 0;
+    // Registers were forced above
+    bool inputsChanged = true;
     while (!Verilated::gotFinish()) {
 
         // Are we shadowing from VICE? Wait for sync data, then
@@ -934,8 +1704,38 @@ int main(int argc, char** argv, char** env) {
 	   }
 
            // Do not change state before this line
-           if (ipc_receive(ipc))
-              break;
+           if (stimPlay) {
+              if (stim_next(stimPlay, state))
+                 break;
+           } else {
+              uint64_t ipcStart = stats_begin();
+              if (ipc_receive(ipc))
+                 break;
+              stats_end(STAT_IPC, ipcStart);
+              if (state->version != VICII_STATE_VERSION) {
+                 LOG(LOG_ERROR, "VICE uses state version %u, we use %u",
+                     state->version, VICII_STATE_VERSION);
+                 // Don't leave VICE waiting on a response
+                 state->flags |= VICII_OP_VERSION_MISMATCH;
+                 ipc_receive_done(ipc);
+                 break;
+              }
+           }
+
+           // VICE has seen everything we flagged so far
+           state->dirty = 0;
+
+           // Nothing of the last batch carries over
+           batchIndex = 0;
+           if (ipc) {
+              ipc->batch->stop = 0;
+              ipc->batch->mismatch = 0;
+           }
+           if ((state->flags & VICII_OP_SYNC_STATE) &&
+                  (state->flags & VICII_OP_BATCH)) {
+              LOG(LOG_ERROR, "batch ignored, can't be combined with sync");
+              state->flags &= ~VICII_OP_BATCH;
+           }
 
            capture = (state->flags & VICII_OP_CAPTURE_START);
            if (!captureByFrame) {
@@ -945,47 +1745,10 @@ int main(int argc, char** argv, char** env) {
            }
 
            if (state->flags & VICII_OP_SYNC_STATE) {
+               if (stimRec)
+                  stim_sync(stimRec, state);
                state->flags &= ~VICII_OP_SYNC_STATE;
-               // Step forward until we get to the target cycle/line/phase.
-               // rasterline and when dot4x just ticked low (we always tick into high
-               // when beginning to step so we must leave dot4x low. We
-	       // don't have to worry about going over the last xpos or
-	       // the repeats on the R8 because the VICE sync won't attempt
-	       // a sync past xpos 0x17c.
-               while (true) {
-                  top->eval();
-
-		  if (top->V_CYCLE_NUM == state->cycle_num &&
-				  top->V_RASTER_LINE == state->raster_line &&
-				  top->clk_phi) break;
-
-#if VM_TRACE
-	          if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
-#endif
-                  ticks = nextTick(top, tfp, chip);
-                  STATE(top);
-                  STORE_PREV();
-               }
-
-               // Now 3 more ticks + 1 more from leaving this block
-               // and we will land one 'step' into our target cycle.
-               for (int i=0; i< 3; i++) {
-                  top->eval();
-#if VM_TRACE
-	          if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
-#endif
-                  ticks = nextTick(top, tfp, chip);
-                  STATE(top);
-                  STORE_PREV();
-               }
-
-	       regs_vice_to_fpga(top, state);
-
-               // Our next tick will bring us high so we should be low right now.
-               CHECK(top, ~top->clk_phi, __LINE__);
-
-               LOG(LOG_INFO, "synced FPGA to cycle=%u, raster_line=%u, xpos=%03x, bmm=%d, mcm=%d, ecm=%d",
-                  state->cycle_num, state->raster_line, state->xpos, top->V_BMM, top->V_MCM, top->V_ECM);
+               syncToState(top, state, chip);
 
 	      // Respond to IPC immediately after 1 more tick. This will land us 4 ticks into the
 	      // high phase which is where VICE ipc hook expects us to be.
@@ -994,7 +1757,18 @@ int main(int argc, char** argv, char** env) {
 	      last_phase = 0;
            } else {
               ticksUntilDone = 4;
+
+              if ((state->flags & VICII_OP_BATCH) && ipc &&
+                     ipc->batch->count > 0) {
+                 if (ipc->batch->count > IPC_BATCH_MAX)
+                    ipc->batch->count = IPC_BATCH_MAX;
+                 ipc->batch->stop = ipc->batch->count;
+                 batchLoad(state, &ipc->batch->in[0]);
+              }
 	   }
+
+           if (stimRec)
+              stim_step(stimRec, state);
         }
 
         if (shadowVic) {
@@ -1013,11 +1787,35 @@ int main(int argc, char** argv, char** env) {
            top->ce = state->ce;
            top->rw = state->rw;
 	   top->lp = state->lp;
+           inputsChanged = true;
+        }
 
+        if (c64 && c64Step(top, c64))
+           inputsChanged = true;
+
+        // Evaluate model. nextTick() already evaluated the last clock
+        // edge so this is only needed if inputs changed since then.
+        if (inputsChanged) {
+           uint64_t evalStart = stats_begin();
+           top->eval();
+           stats_end(STAT_EVAL, evalStart);
+#if VM_TRACE
+	   trace_dump(ticks / TICKS_TO_TIMESCALE);
+#endif
+           inputsChanged = false;
         }
 
-        // Evaluate model
-        top->eval();
+#if VM_TRACE
+        if (tracing)
+           trace_step(top);
+#endif
+
+        if (captureByTime)
+           capture = (ticks >= startTicks) && (ticks <= endTicks);
+
+        // Edges of the watched signals since the last tick. This also
+        // runs the dot clock checks.
+        watch_sample();
 
         if (shadowVic) {
            if (state->flags & VICII_OP_BUS_ACCESS) {
@@ -1025,166 +1823,81 @@ int main(int argc, char** argv, char** env) {
            }
 	}
 
-#if VM_TRACE
-	if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
-#endif
-
         if (showState) {
            STATE(top);
         }
 
-        if (captureByTime)
-           capture = (ticks >= startTicks) && (ticks <= endTicks);
-
         if (capture) {
-          // On dot clock...
-          if (HASCHANGED(OUT_DOT) && RISING(OUT_DOT)) {
-             // AEC should always be low in first phase. But AEC is
-	     // slightly delayed so don't check this when bit cycle is 0
-             if (top->V_CYCLE_BIT > 0 && top->V_CYCLE_BIT < 4) {
-               CHECK(top, top->aec == 0, __LINE__);
-             }
-
-             // Make sure xpos is what we expect at key points
-             if (top->V_CYCLE_NUM == 12 && top->V_CYCLE_BIT == 4)
-               CHECK (top, top->V_XPOS == 0, __LINE__); // rollover
-
-             if (top->V_CYCLE_NUM == 0 && top->V_CYCLE_BIT == 0)
-               if (chip == CHIP6569R1 || chip == CHIP6569R3)
-                  CHECK (top, top->V_XPOS == 0x194, __LINE__); // reset
-               else
-                  CHECK (top, top->V_XPOS == 0x19c, __LINE__); // reset
-
-             if (chip == CHIP6567R8)
-               if (top->V_CYCLE_NUM == 61 && (top->V_CYCLE_BIT == 0 || top->V_CYCLE_BIT == 4))
-                  CHECK (top, top->V_XPOS == 0x184, __LINE__); // repeat cases
-               else if (top->V_CYCLE_NUM == 62 && top->V_CYCLE_BIT == 0)
-                  CHECK (top, top->V_XPOS == 0x184, __LINE__); // repeat case
-
-             // Refresh counter is supposed to reset at raster 0
-             //if (top->V_RASTER_X == 0 && top->V_RASTER_LINE == 0) TODO Put back
-             //   CHECK (top, top->V_REFC == 0xff, __LINE__);
-
-          }
-
           // If rendering, draw current color on dot clock
 	  // Our simulator resolution is twice that of native so we can
 	  // update every other dot clock tick.
 	  // dot_rising[1] || dot_rising[3]
-          if (showWindow && HASCHANGED(OUT_DOT_RISING) &&
+          if (render && HASCHANGED(OUT_DOT_RISING) &&
 			  (top->V_CLK_DOT == 2 || top->V_CLK_DOT == 8)) {
-#ifdef GEN_RGB
-            // Show h/v sync in red
-            if (!hideSync && (!top->hsync || !top->vsync))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                0b0,
-                255);
-            else {
-             double rr = top->red * 255.0/63.0;
-             double gg = top->green * 255.0/63.0;
-             double bb = top->blue * 255.0/63.0;
-             SDL_SetRenderDrawColor(ren, rr, gg, bb, 255);
-            }
-
-            // PURPLE ACTIVE AREA - DEBUGGING
-            if (showActive && (top->active))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                255,
-                0b0);
-#else 
-#ifdef NEED_RGB
-            // Show h/v sync in red
-            if (!hideSync && (top->HSYNC || top->VSYNC))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                0b0,
-                255);
-            else {
-             double rr = top->top__DOT__red * 255.0/63.0;
-             double gg = top->top__DOT__green * 255.0/63.0;
-             double bb = top->top__DOT__blue * 255.0/63.0;
-             SDL_SetRenderDrawColor(ren, rr,gg,bb,255);
-            }
-
-            // PURPLE ACTIVE AREA - DEBUGGING
-            if (showActive && (top->ACTIVE))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                255,
-                0b0);
-
-#else
-#ifdef GEN_LUMA_CHROMA
-            // Fallback to native pixel sequencer's pixel3 value
-	    // and lookup colors.
-            int hss = 10; // see comp_sync.v  top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__hsync_start;
-            int hse = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__hsync_end;
-            int vss = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vblank_start;
-            //int vse = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vblank_end;
-            int vve = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vvisible_end;
-            int vvs = top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__vvisible_start;
-	    // This is the same condition in comp_sync.v
-            int vsync = (top->V_RASTER_LINE >= vve && top->V_RASTER_LINE <= vvs);
-            // If we're not in vsync or within native active range, show pixel colors
-	    if ((!vsync && top->top__DOT__vic_inst__DOT__vic_comp_sync__DOT__native_active) || hideSync) {
-	       int index = top->top__DOT__vic_inst__DOT__pixel_color3;
-               SDL_SetRenderDrawColor(ren,
-                (native_rgb[index*3] << 2) | 0b11,
-                (native_rgb[index*3+1] << 2) | 0b11,
-                (native_rgb[index*3+2] << 2) | 0b11,
-                255);
-	    } else {
-               // NOTE: If we're in vsync show red color, except we omit vve and vss to match what comp_sync.v does
-               // (special cases)
-	       if ((top->V_RASTER_X >= hss && top->V_RASTER_X < hse) ||
-                      (vsync && top->V_RASTER_LINE != vve && top->V_RASTER_LINE != vvs))
-#ifdef HAVE_LUMA_SINK
-                  SDL_SetRenderDrawColor(ren, 255*top->V_LUMA_SINK,0,0,255);
-#else
-                  // Only for old beta boards
-                  SDL_SetRenderDrawColor(ren, 255,0,0,255);
-#endif
-	       else
-                  SDL_SetRenderDrawColor(ren, 0,0,0,255);
-	    }
-#else
-#warning "There are no video output options available. Simulator will show nothing"
-#endif
-#endif
-#endif
 	     int hoffset = top->V_CLK_DOT == 2 ? 0 : 1;
-             drawPixel(ren,
-                top->V_RASTER_X*2+hoffset,
-                top->V_RASTER_LINE
-             );
-
-             // Show updated pixels per raster line
-             if (prevY != top->V_RASTER_LINE) {
-                prevY = top->V_RASTER_LINE;
-
-                if (scanline) {
-                   for (int xx=0; xx < 504; xx++) {
-                     SDL_SetRenderDrawColor(ren, 255, 255, 255, 255);
-                     drawPixel(ren, xx*2, top->V_RASTER_LINE+1);
+             uint64_t drawStart = stats_begin();
+             fb_put(fb, top->V_RASTER_X*2+hoffset, top->V_RASTER_LINE,
+                pixelColor(top, hideSync, showActive));
+             stats_end(STAT_DRAW, drawStart);
+          }
+
+          // Hand out the frame once the raster wraps back to the top.
+          // A frame we joined part way through is not handed out.
+          if (prevY != top->V_RASTER_LINE) {
+             if (top->V_RASTER_LINE < prevY) {
+                if (fullFrame) {
+                   bool writeFrame = framePattern != nullptr;
+                   if (hashOut || golden) {
+                      fh_compute(fb, &frameHash);
+                      if (hashOut)
+                         fh_write(hashOut, testName, chip, hashConfig,
+                                  numFrames, &frameHash);
+                      if (golden) {
+                         int line = fh_compare(golden, numFrames, &frameHash);
+                         if (line == -2) {
+                            LOG(LOG_WARN, "frame %ld not in golden manifest",
+                                numFrames);
+                         } else if (line >= 0) {
+                            LOG(LOG_ERROR, "frame %ld differs from golden "
+                                "manifest from raster line %d", numFrames, line);
+                            hashMismatches++;
+                         } else {
+                            // Only keep images for frames that changed
+                            writeFrame = false;
+                         }
+                      }
                    }
+                   if (writeFrame)
+                      fb_write_ppm(fb, framePattern, numFrames);
+
+                   numFrames++;
+                   statFrames++;
+                   if (maxFrames > 0 && numFrames >= maxFrames)
+                      stopRequested = true;
                 }
+                fullFrame = true;
+             } else if (prevY == -1 && top->V_RASTER_LINE == 0) {
+                fullFrame = true;
+             }
 
-                SDL_RenderPresent(ren);
-                SDL_PollEvent(&event);
-                switch (event.type) {
-                   case SDL_QUIT:
-                      state->flags |= VICII_OP_CAPTURE_END;
-                      break;
-                   default:
-                      break;
+             // Time whole frames only
+             if (benchmark && fullFrame && numFrames == 0 && benchStart == 0)
+                benchStart = wallSeconds();
+
+             // Show the lines completed so far
+             if (showWindow) {
+                markDirty(prevY, prevY);
+                if (presentDue()) {
+                   uint64_t drawStart = stats_begin();
+                   showFrame(ren, tex, fb, scanline, top->V_RASTER_LINE);
+                   stats_end(STAT_DRAW, drawStart);
+                   while (SDL_PollEvent(&event)) {
+                      if (event.type == SDL_QUIT)
+                         stopRequested = true;
+                   }
                 }
              }
+             prevY = top->V_RASTER_LINE;
           }
         }
 
@@ -1221,8 +1934,6 @@ int main(int argc, char** argv, char** env) {
 	   state->raster_line = top->V_RASTER_LINE_D;
            state->cycleByCycleStepping = cycleByCycle;
 	   state->idle = top->V_IDLE;
-	   state->allow_bad_lines = top->V_ALLOW_BAD_LINES;
-	   state->reg11_delayed = top->V_REG11_DELAYED;
 	   state->vborder = top->V_VBORDER;
 	   state->main_border = top->V_MAIN_BORDER;
 	   state->pps = top->V_PPS;
@@ -1235,7 +1946,7 @@ int main(int argc, char** argv, char** env) {
            regs_fpga_to_vice(top, state);
 
            bool needQuit = false;
-           if (state->flags & VICII_OP_CAPTURE_END) {
+           if ((state->flags & VICII_OP_CAPTURE_END) || stopRequested) {
               keyPressToQuit = false;
               needQuit = true;
            }
@@ -1245,7 +1956,8 @@ int main(int argc, char** argv, char** env) {
               top->V_XPOS == captureByFrameStopXpos &&
                  top->V_RASTER_LINE == captureByFrameStopYpos) {
               state->flags &= ~VICII_OP_CAPTURE_START;
-              ipc_receive_done(ipc);
+              if (ipc)
+                 ipc_receive_done(ipc);
               break;
            }
 	   if (viceCapture) {
@@ -1255,14 +1967,18 @@ int main(int argc, char** argv, char** env) {
 		     }
 	      } else if (top->V_XPOS == lastXPos && top->V_RASTER_LINE == screenHeight - 1) {
 		 state->flags |= VICII_OP_CAPTURE_ABORT;
-                 ipc_receive_done(ipc);
-
-                 SDL_Surface *sshot = SDL_CreateRGBSurface(0, screenWidth*2, screenHeight*2,
-                     32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
-                 SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_ARGB8888,
-                                      sshot->pixels, sshot->pitch);
-                 SDL_SaveBMP(sshot, "screenshot.bmp");
-                 SDL_FreeSurface(sshot);
+                 if (ipc)
+                    ipc_receive_done(ipc);
+
+                 saveScreenshot(fb, "screenshot.bmp");
+                 if (framePattern)
+                    fb_write_ppm(fb, framePattern, numFrames);
+                 if (ipc)
+                    ipc_close(ipc);
+#ifdef SIM_SAVABLE
+                 if (cacheDir)
+                    clearSnapshots(chip);
+#endif
                  exit(0);
 	      }
 	   }
@@ -1270,10 +1986,44 @@ int main(int argc, char** argv, char** env) {
            ticksUntilDone--;
            ticksUntilPhase--;
 
+           if (ticksUntilDone == 0 || needQuit) {
+              if (stimRec)
+                 stim_result(stimRec, state);
+
+              if (stimPlay) {
+                 unsigned int bad = stim_check(stimPlay, state);
+                 if (bad) {
+                    LOG(LOG_ERROR, "step %ld mismatch %x at cycle=%u, raster_line=%u, xpos=%03x",
+                       stimPlay->steps, bad, state->cycle_num,
+                          state->raster_line, state->xpos);
+                    replayMismatches++;
+                 }
+              }
+           }
+
+           // Move on to the next batch entry without responding
+           if (ticksUntilDone == 0 && (state->flags & VICII_OP_BATCH) &&
+                  ipc && ipc->batch->count > 0) {
+              struct vicii_batch* batch = ipc->batch;
+              unsigned int bad = batchStore(state, &batch->in[batchIndex],
+                                            &batch->out[batchIndex]);
+              if (bad) {
+                 batch->stop = batchIndex;
+                 batch->mismatch = bad;
+              } else if (++batchIndex < batch->count) {
+                 batchLoad(state, &batch->in[batchIndex]);
+                 if (stimRec)
+                    stim_step(stimRec, state);
+                 ticksUntilDone = 4;
+              }
+           }
+
            if (ticksUntilDone == 0 || needQuit) {
               // Do not change state after this line
-              if (ipc_receive_done(ipc))
+              uint64_t ipcStart = stats_begin();
+              if (ipc && ipc_receive_done(ipc))
                  break;
+              stats_end(STAT_IPC, ipcStart);
            }
 
            if (needQuit) {
@@ -1303,8 +2053,10 @@ int main(int argc, char** argv, char** env) {
 		// Pause after first tick of next phase
 		printf ("(PAUSE NEXT PHASE 1st tick)\n");
 
-		if (showWindow && cycleByCycleCount == 0)
-                   SDL_RenderPresent(ren);
+		if (showWindow && cycleByCycleCount == 0) {
+                   markDirty(prevY, prevY);
+                   showFrame(ren, tex, fb, scanline, prevY);
+                }
 
 		if (cycleByCycleCount == 0) {
                   bool quit = false;
@@ -1312,7 +2064,7 @@ int main(int argc, char** argv, char** env) {
                      while (SDL_PollEvent(&event)) {
 			SDL_KeyboardEvent* ke = (SDL_KeyboardEvent*)&event;
 			int n;
-			struct vicii_state tmp_state;
+			struct vicii_state tmp_state = {};
                         switch (event.type) {
                            case SDL_QUIT:
                                  quit=true; break;
@@ -1335,7 +2087,7 @@ int main(int argc, char** argv, char** env) {
                                     quit=true; break;
 				 // Show regs
                                  case SDLK_r:
-				    regs_fpga_to_vice(top, &tmp_state);
+				    read_fpga_regs(top, &tmp_state);
 				    for (n=0;n<0x2f;n++) {
                                        printf ("%02x=%02x %s\n", n,
                                           tmp_state.fpga_reg[n],
@@ -1368,15 +2120,72 @@ int main(int argc, char** argv, char** env) {
         if (captureByTime && ticks >= endTicks)
            break;
 
+        if (stopRequested && !shadowVic)
+           break;
+
         // Advance simulation time. Each tick represents 1 picosecond.
-        ticks = nextTick(top, tfp, chip);
+        ticks = nextTick(top);
+        stats_poll();
+#ifdef SIM_SAVABLE
+        if (cacheDir)
+           takeSnapshot(top, chip);
+#endif
     }
 
-    if (shadowVic) {
+#ifdef SIM_SAVABLE
+    if (cacheDir)
+       clearSnapshots(chip);
+#endif
+
+    if (ipc) {
        ipc_close(ipc);
     }
 
+    if (stimRec) {
+       stim_close(stimRec);
+    }
+
+    if (c64) {
+       c64_free(c64);
+    }
+
+    if (stimPlay) {
+       printf ("replayed %ld steps, %ld mismatches\n",
+          stimPlay->steps, replayMismatches);
+       stim_close(stimPlay);
+    }
+
+    if (hashOut) {
+       fclose(hashOut);
+    }
+
+    if (golden) {
+       printf ("%s: %ld frames, %ld differ from golden manifest\n",
+          testName, numFrames, hashMismatches);
+       fh_free_manifest(golden);
+    }
+    free(frameHash.lines);
+
+#ifdef SIM_SAVABLE
+    if (saveFile) {
+       saveState(top, saveFile, chip);
+    }
+#endif
+
+    stats_finish();
+
+    if (benchmark) {
+       double secs = wallSeconds() - benchStart;
+       printf ("chip=%d threads=%d frames=%ld secs=%.3f fps=%.3f\n",
+          chip, SIM_THREADS, numFrames, secs,
+          secs > 0 ? numFrames / secs : 0);
+    }
+
     if (showWindow) {
+       // Whatever we have of the last frame
+       markDirty(0, fb->height - 1);
+       showFrame(ren, tex, fb, false, -1);
+
        bool quit = false;
        while (!quit && keyPressToQuit) {
           while (SDL_PollEvent(&event)) {
@@ -1390,21 +2199,27 @@ int main(int argc, char** argv, char** env) {
            }
        }
 
+       SDL_DestroyTexture(tex);
        SDL_DestroyRenderer(ren);
        SDL_DestroyWindow(win);
        SDL_Quit();
     }
 
+    if (fb) {
+       fb_free(fb);
+    }
+
     // Final model cleanup
     top->final();
 
 #if VM_TRACE
-    if (tfp) { tfp->close(); tfp = NULL; }
+    trace_close();
 #endif
+    statelog_close();
 
     // Destroy model
     delete top;
 
     // Fin
-    exit(0);
+    exit(replayMismatches || hashMismatches ? 1 : 0);
 }
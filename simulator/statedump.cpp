@@ -0,0 +1,104 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Print a binary state log (vicsim -L) as the same table -l 4 prints.
+//
+//    statedump [-n <rows>] <file>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "statelog.h"
+
+int main(int argc, char** argv) {
+   long last = -1;
+   int c;
+
+   while ((c = getopt(argc, argv, "n:h")) != -1) {
+      switch (c) {
+         case 'n':
+            last = atol(optarg);
+            break;
+         default:
+            fprintf(stderr, "Usage: statedump [-n <last rows>] <file>\n");
+            return 1;
+      }
+   }
+   if (optind >= argc) {
+      fprintf(stderr, "Usage: statedump [-n <last rows>] <file>\n");
+      return 1;
+   }
+
+   const char* filename = argv[optind];
+   int fd = open(filename, O_RDONLY);
+   struct stat st;
+   if (fd < 0 || fstat(fd, &st) != 0) {
+      perror(filename);
+      return 1;
+   }
+   if ((size_t) st.st_size < sizeof(struct statelog_header)) {
+      fprintf(stderr, "%s: not a state log\n", filename);
+      return 1;
+   }
+
+   void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (p == MAP_FAILED) {
+      perror(filename);
+      return 1;
+   }
+
+   struct statelog_header* hdr = (struct statelog_header*) p;
+   if (hdr->magic != STATELOG_MAGIC || hdr->version != STATELOG_VERSION ||
+          hdr->recordSize != sizeof(struct state_rec)) {
+      fprintf(stderr, "%s: not a state log or wrong version\n", filename);
+      return 1;
+   }
+
+   uint64_t avail = (st.st_size - sizeof(struct statelog_header)) /
+                       sizeof(struct state_rec);
+   uint64_t capacity = hdr->capacity;
+   uint64_t num = hdr->count < capacity ? hdr->count : capacity;
+   if (num > avail) {
+      fprintf(stderr, "%s: truncated, %lu of %lu records\n", filename,
+              (unsigned long) avail, (unsigned long) num);
+      num = avail;
+   }
+   uint64_t first = hdr->count > capacity ? hdr->count % capacity : 0;
+   if (last >= 0 && (uint64_t) last < num) {
+      first = (first + num - last) % capacity;
+      num = last;
+   }
+
+   struct state_rec* recs = (struct state_rec*) (hdr + 1);
+   char line[256];
+
+   // The lines look like -l 4 output so the two can be diffed
+   printf("verb: %s\n", statelog_titles);
+   for (uint64_t i = 0; i < num; i++) {
+      struct state_rec* r = &recs[(first + i) % capacity];
+      if (r->flags & SR_DOT_RISE)
+         printf("verb: %s\n", statelog_titles);
+      printf("verb: %s\n", statelog_format(r, line));
+   }
+
+   munmap(p, st.st_size);
+   close(fd);
+   return 0;
+}
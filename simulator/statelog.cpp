@@ -0,0 +1,223 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "statelog.h"
+
+const char* statelog_titles =
+   "  "
+   "D4X "
+   "CNT "
+   "POS "
+   "CYC "
+   "DOTR "
+   "PHI "
+   "BIT "
+   "IRQ "
+   "BA "
+   "AEC "
+   "VCY "
+   "RAS "
+   "CAS "
+   " X  "
+   " Y  "
+   " Y  "
+   "ADI  "
+   "ADO  "
+   "DBI "
+   "DBO "
+   "RW "
+   "CE "
+   "RFC "
+   "BIN";
+
+static int statelogFd = -1;
+static size_t statelogSize;
+static struct statelog_header* statelogHdr;
+static struct state_rec* statelogRecs;
+static uint64_t statelogNext;
+
+static char cycleToChar(int cycle) {
+  switch (cycle) {
+    case VIC_LP   : return '#';
+    case VIC_LPI2 : return 'i';
+    case VIC_LS2  : return 's';
+    case VIC_LR   : return 'r';
+    case VIC_LG   : return 'g';
+    case VIC_HS1  : return 'S';
+    case VIC_HPI1 : return 'I';
+    case VIC_HPI3 : return 'I';
+    case VIC_HS3  : return 'S';
+    case VIC_HRI  : return 'I';
+    case VIC_HRC  : return 'C';
+    case VIC_HGC  : return 'C';
+    case VIC_HGI  : return 'I';
+    case VIC_HI   : return 'I';
+    case VIC_LI   : return 'i';
+    case VIC_HRX  : return 'x';
+    default       : return '?';
+  }
+}
+
+static char* toBin(char* buf, int len, unsigned long reg) {
+   for (int c = 0; c < len; c++)
+      buf[len - 1 - c] = reg & (1UL << c) ? '1' : '0';
+   buf[len] = '\0';
+   return buf;
+}
+
+#define F(bit) (r->flags & (bit) ? 1 : 0)
+
+char* statelog_format(const struct state_rec* r, char* buf) {
+   char pps[17];
+   char phir[33];
+
+   sprintf(buf,
+   "%c "      /*DOT*/
+   "%01d   "   /*D4x*/
+   "%02d  "   /*CNT*/
+   "%03x "   /*POS*/
+   " %02d "  /*CYC*/
+   " %01d  "   /*DOTR*/
+   " %01d  "   /*PHI*/
+   " %01d  "   /*BIT*/
+   " %01d  "   /*IRQ*/
+   " %01d  "   /*BA */
+   " %01d  "   /*AEC*/
+   "%c  "     /*VCY*/
+   " %01d  "   /*RAS*/
+   " %01d  "   /*CAS*/
+   "%03d "   /*  X*/
+   "%03d "   /*  Y*/
+   "%03d "   /*  Y*/
+   "%04x "   /*ADI*/
+   "%04x "   /*ADO*/
+   " %02x "   /*DBI*/
+   " %02x "   /*DBO*/
+   " %01d "   /* RW*/
+   " %01d "   /* CE*/
+   "%02x "   /*RFC*/
+   " %s"     /*BIN*/
+   " %s"     /*BIN*/
+   " %s"     /*BIN*/
+   " %d"     /*badline*/
+
+   " %03d"
+   " %03d"
+   " %01d"
+   " %04x"
+   " %01d"
+   ,
+
+   F(SR_RST) ? 'R' : F(SR_DOT_RISE) ? '*' : ' ',
+   F(SR_D4X),
+   r->cnt,
+   r->xpos,
+   r->cycleNum,
+   F(SR_DOTR),
+   F(SR_PHI),
+   r->cycleBit,
+   F(SR_IRQ),
+   F(SR_BA),
+   F(SR_AEC),
+   cycleToChar(r->cycleType),
+   F(SR_RAS),
+   F(SR_CAS),
+   r->rasterX,
+   r->rasterLine,
+   r->rasterLineD,
+   r->adi,
+   r->ado,
+   r->dbi,
+   r->dbo,
+   F(SR_RW),
+   F(SR_CE),
+   r->refc,
+   toBin(pps, 16, r->pps),
+   toBin(phir, 32, r->phir),
+   " ",
+   F(SR_BADLINE),
+   r->spriteMc,
+   r->spriteMcBase,
+   r->rc,
+   r->vicAddr,
+   F(SR_BMM)
+   );
+   return buf;
+}
+
+int statelog_open(const char* filename, uint64_t capacity) {
+   statelogFd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (statelogFd < 0)
+      return 1;
+
+   statelogSize = sizeof(struct statelog_header) +
+                     capacity * sizeof(struct state_rec);
+   if (ftruncate(statelogFd, statelogSize) != 0) {
+      close(statelogFd);
+      statelogFd = -1;
+      return 1;
+   }
+
+   void* p = mmap(NULL, statelogSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  statelogFd, 0);
+   if (p == MAP_FAILED) {
+      close(statelogFd);
+      statelogFd = -1;
+      return 1;
+   }
+
+   statelogHdr = (struct statelog_header*) p;
+   statelogRecs = (struct state_rec*) (statelogHdr + 1);
+   statelogHdr->magic = STATELOG_MAGIC;
+   statelogHdr->version = STATELOG_VERSION;
+   statelogHdr->recordSize = sizeof(struct state_rec);
+   statelogHdr->count = 0;
+   statelogHdr->capacity = capacity;
+   statelogNext = 0;
+   return 0;
+}
+
+struct state_rec* statelog_next() {
+   struct state_rec* r = &statelogRecs[statelogNext];
+   if (++statelogNext == statelogHdr->capacity)
+      statelogNext = 0;
+   statelogHdr->count++;
+   return r;
+}
+
+void statelog_close() {
+   if (statelogFd < 0)
+      return;
+   uint64_t count = statelogHdr->count;
+   uint64_t capacity = statelogHdr->capacity;
+   munmap(statelogHdr, statelogSize);
+
+   // Don't leave the unused part of the ring on disk
+   if (count < capacity) {
+      if (ftruncate(statelogFd, sizeof(struct statelog_header) +
+                       count * sizeof(struct state_rec)) != 0)
+         perror("statelog");
+   }
+   close(statelogFd);
+   statelogFd = -1;
+}
@@ -0,0 +1,103 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_STATELOG_H
+#define VICII_STATELOG_H
+
+#include <stdint.h>
+
+// Binary log of the half cycle state table (what -l 4 prints).
+//
+// Printing the table costs far more than simulating, so -L writes one
+// packed record per row to a file instead.  The file is mapped into
+// memory and used as a ring of the last N records, so a record is a
+// plain store with no formatting and no system call.  statedump turns
+// the file back into the same table -l 4 prints.
+//
+// File layout: struct statelog_header, then capacity records.  When
+// more than capacity records were written, the oldest one is at
+// count % capacity.
+
+#define STATELOG_MAGIC   0x54535456  // "VTST"
+#define STATELOG_VERSION 2
+
+// Default ring size, about a PAL frame and a half
+#define STATELOG_RECORDS (1 << 20)
+
+// state_rec.flags
+#define SR_RST      0x0001
+#define SR_DOT_RISE 0x0002
+#define SR_D4X      0x0004
+#define SR_DOTR     0x0008
+#define SR_PHI      0x0010
+#define SR_IRQ      0x0020
+#define SR_BA       0x0040
+#define SR_AEC      0x0080
+#define SR_RAS      0x0100
+#define SR_CAS      0x0200
+#define SR_RW       0x0400
+#define SR_CE       0x0800
+#define SR_BADLINE  0x1000
+#define SR_BMM      0x2000
+
+struct statelog_header {
+   uint32_t magic;
+   uint16_t version;
+   uint16_t recordSize;
+   uint64_t count;      // records written, may be more than capacity
+   uint64_t capacity;
+};
+
+#pragma pack(push, 1)
+struct state_rec {
+   uint16_t flags;
+   uint8_t cnt;
+   uint8_t cycleNum;
+   uint8_t cycleBit;    // 0-7, not just a flag
+   uint8_t cycleType;
+   uint8_t dbi;
+   uint8_t dbo;
+   uint8_t refc;
+   uint8_t rc;
+   uint8_t spriteMc;
+   uint8_t spriteMcBase;
+   uint16_t xpos;
+   uint16_t rasterX;
+   uint16_t rasterLine;
+   uint16_t rasterLineD;
+   uint16_t adi;
+   uint16_t ado;
+   uint16_t vicAddr;
+   uint16_t pps;
+   uint32_t phir;
+};
+#pragma pack(pop)
+
+// Column titles of the table
+extern const char* statelog_titles;
+
+// Render one row of the table into buf (256 chars is plenty)
+char* statelog_format(const struct state_rec* r, char* buf);
+
+// Map filename as a ring of capacity records. Returns non-zero on error.
+int statelog_open(const char* filename, uint64_t capacity);
+
+// Next record to fill in
+struct state_rec* statelog_next();
+
+void statelog_close();
+
+#endif
@@ -0,0 +1,147 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+bool statsOn;
+struct stat_timer statTimers[STAT_NUM];
+uint64_t statFrames;
+
+static const char* statNames[STAT_NUM] = {
+   "tick", "eval", "draw", "trace", "ipc"
+};
+
+static const char* statsJson;
+static FILE* summaryOut;
+static double startWall;
+static uint64_t startNow;
+static unsigned int pollCount;
+
+// Totals at the last summary so each one covers its own interval
+static double lastWall;
+static struct stat_timer lastTimers[STAT_NUM];
+static uint64_t lastFrames;
+
+double wallSeconds() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// stats_now() units per second, measured over the whole run
+static double nowRate(double wall) {
+   double secs = wall - startWall;
+   if (secs <= 0)
+      return 1e9;
+   return (stats_now() - startNow) / secs;
+}
+
+static void summary(const char* what, double secs, struct stat_timer* timers,
+                    uint64_t frames, double rate) {
+   if (secs <= 0)
+      return;
+   fprintf (summaryOut,
+      "stats %s %.1fs: ticks/s=%.0f evals/s=%.0f frames/s=%.2f",
+      what, secs, timers[STAT_TICK].count / secs,
+      timers[STAT_EVAL].count / secs, frames / secs);
+   for (int i = 0; i < STAT_NUM; i++)
+      fprintf (summaryOut, " %s=%.1f%%", statNames[i],
+         100.0 * timers[i].time / rate / secs);
+   fprintf (summaryOut, "\n");
+}
+
+void stats_init(const char* jsonFile) {
+   statsOn = true;
+   statsJson = jsonFile;
+   // Keep stdout clean for the JSON when that's where it goes
+   summaryOut = jsonFile && strcmp(jsonFile, "-") == 0 ? stderr : stdout;
+   startWall = lastWall = wallSeconds();
+   startNow = stats_now();
+}
+
+void stats_poll() {
+   // Only look at the clock every so often
+   if (!statsOn || (++pollCount & 0xffff) != 0)
+      return;
+
+   double wall = wallSeconds();
+   if (wall - lastWall < STATS_INTERVAL)
+      return;
+
+   struct stat_timer delta[STAT_NUM];
+   for (int i = 0; i < STAT_NUM; i++) {
+      delta[i].count = statTimers[i].count - lastTimers[i].count;
+      delta[i].time = statTimers[i].time - lastTimers[i].time;
+      lastTimers[i] = statTimers[i];
+   }
+   summary("interval", wall - lastWall, delta, statFrames - lastFrames,
+           nowRate(wall));
+   lastFrames = statFrames;
+   lastWall = wall;
+   fflush(summaryOut);
+}
+
+void stats_finish() {
+   if (!statsOn)
+      return;
+   statsOn = false;
+
+   double wall = wallSeconds();
+   double secs = wall - startWall;
+   double rate = nowRate(wall);
+   summary("total", secs, statTimers, statFrames, rate);
+
+   if (!statsJson)
+      return;
+
+   FILE* fp = stdout;
+   if (strcmp(statsJson, "-") != 0) {
+      fp = fopen(statsJson, "w");
+      if (!fp) {
+         perror(statsJson);
+         return;
+      }
+   }
+
+   fprintf(fp, "{\n");
+   fprintf(fp, "  \"secs\": %.6f,\n", secs);
+   fprintf(fp, "  \"ticks\": %lu,\n",
+           (unsigned long) statTimers[STAT_TICK].count);
+   fprintf(fp, "  \"evals\": %lu,\n",
+           (unsigned long) statTimers[STAT_EVAL].count);
+   fprintf(fp, "  \"frames\": %lu,\n", (unsigned long) statFrames);
+   fprintf(fp, "  \"ticks_per_sec\": %.1f,\n",
+           secs > 0 ? statTimers[STAT_TICK].count / secs : 0);
+   fprintf(fp, "  \"evals_per_sec\": %.1f,\n",
+           secs > 0 ? statTimers[STAT_EVAL].count / secs : 0);
+   fprintf(fp, "  \"frames_per_sec\": %.3f,\n",
+           secs > 0 ? statFrames / secs : 0);
+   fprintf(fp, "  \"timers\": {\n");
+   for (int i = 0; i < STAT_NUM; i++) {
+      fprintf(fp, "    \"%s\": { \"count\": %lu, \"secs\": %.6f }%s\n",
+              statNames[i], (unsigned long) statTimers[i].count,
+              statTimers[i].time / rate, i < STAT_NUM - 1 ? "," : "");
+   }
+   fprintf(fp, "  }\n");
+   fprintf(fp, "}\n");
+
+   if (fp != stdout)
+      fclose(fp);
+}
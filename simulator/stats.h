@@ -0,0 +1,94 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_STATS_H
+#define VICII_STATS_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+// Run time counters and timers (-j).
+//
+// Shows where a run's time goes: evaluating the model, stepping the
+// clocks, drawing, tracing or waiting on VICE.  Timers read the TSC
+// (clock_gettime elsewhere) and are converted to seconds against the
+// wall clock when reported.  With stats off each timer is one branch.
+//
+// A summary is printed every STATS_INTERVAL seconds and at the end,
+// and the totals can be written as JSON.  The summaries go to stderr
+// when the JSON goes to stdout.
+//
+// Each timer costs two TSC reads, so a run with -j is a little slower
+// than one without.
+
+#define STAT_TICK   0   // nextTick(), includes its evals and dumps
+#define STAT_EVAL   1   // top->eval()
+#define STAT_DRAW   2   // pixels into the frame buffer and presenting
+#define STAT_TRACE  3   // trace dumps
+#define STAT_IPC    4   // waiting on VICE in ipc_receive/ipc_receive_done
+#define STAT_NUM    5
+
+#define STATS_INTERVAL 5
+
+struct stat_timer {
+   uint64_t count;
+   uint64_t time;     // stats_now() units
+};
+
+extern bool statsOn;
+extern struct stat_timer statTimers[STAT_NUM];
+extern uint64_t statFrames;
+
+static inline uint64_t stats_now() {
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t stats_begin() {
+   return statsOn ? stats_now() : 0;
+}
+
+static inline void stats_end(int which, uint64_t start) {
+   if (statsOn) {
+      statTimers[which].count++;
+      statTimers[which].time += stats_now() - start;
+   }
+}
+
+// Monotonic wall clock in seconds
+double wallSeconds();
+
+// Start collecting. jsonFile gets the totals at the end, null for
+// none or "-" for stdout.
+void stats_init(const char* jsonFile);
+
+// Print a summary if one is due. Cheap enough to call every tick.
+void stats_poll();
+
+// Print the final summary and write the JSON
+void stats_finish();
+
+#endif
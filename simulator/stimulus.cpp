@@ -0,0 +1,302 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stimulus.h"
+#include "log.h"
+
+// Record tags. A step tag carries the mask of changed inputs in its
+// low bits and is followed by a byte with the mask of changed outputs.
+#define STIM_TAG_SYNC 0x53
+#define STIM_TAG_STEP 0x80
+
+#define IN_ADDR  1
+#define IN_DATA  2
+#define IN_CE    4
+#define IN_RW    8
+#define IN_LP    16
+#define IN_FLAGS 32
+#define IN_VBANK 64
+
+#define OUT_IRQ  1
+#define OUT_BA   2
+#define OUT_AEC  4
+#define OUT_PHI  8
+#define OUT_ADDR 16
+#define OUT_DATA 32
+#define OUT_POS  64
+
+// Flags worth replaying. Sync and batch are implied by the log itself.
+#define STIM_FLAGS (VICII_OP_CAPTURE_START | VICII_OP_CAPTURE_END | \
+                    VICII_OP_BUS_ACCESS | VICII_OP_CAPTURE_ONE_FRAME)
+
+static void put8(FILE* fp, unsigned int v) {
+   fputc(v & 0xff, fp);
+}
+
+static void put16(FILE* fp, unsigned int v) {
+   fputc(v & 0xff, fp);
+   fputc((v >> 8) & 0xff, fp);
+}
+
+// Return 1 on a short read
+static int get8(FILE* fp, unsigned char* v) {
+   int c = fgetc(fp);
+   if (c == EOF)
+      return 1;
+   *v = c;
+   return 0;
+}
+
+static int get16(FILE* fp, unsigned short* v) {
+   int lo = fgetc(fp);
+   int hi = fgetc(fp);
+   if (lo == EOF || hi == EOF)
+      return 1;
+   *v = lo | (hi << 8);
+   return 0;
+}
+
+static struct stimulus* stim_alloc(FILE* fp, int chip, int recording) {
+   struct stimulus* s = (struct stimulus*) calloc(1, sizeof(struct stimulus));
+   s->fp = fp;
+   s->chip = chip;
+   s->recording = recording;
+   return s;
+}
+
+struct stimulus* stim_record(const char* filename, int chip) {
+   FILE* fp = fopen(filename, "wb");
+   if (fp == NULL) {
+      LOG(LOG_ERROR, "can't create %s", filename);
+      return NULL;
+   }
+
+   struct stim_header hdr;
+   hdr.magic = STIM_MAGIC;
+   hdr.version = STIM_VERSION;
+   hdr.chip = chip;
+   hdr.state_size = sizeof(struct vicii_state);
+   fwrite(&hdr, sizeof(hdr), 1, fp);
+
+   return stim_alloc(fp, chip, 1);
+}
+
+struct stimulus* stim_replay(const char* filename) {
+   FILE* fp = fopen(filename, "rb");
+   if (fp == NULL) {
+      LOG(LOG_ERROR, "can't open %s", filename);
+      return NULL;
+   }
+
+   struct stim_header hdr;
+   if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != STIM_MAGIC) {
+      LOG(LOG_ERROR, "%s is not a stimulus log", filename);
+      fclose(fp);
+      return NULL;
+   }
+   if (hdr.version != STIM_VERSION ||
+          hdr.state_size != sizeof(struct vicii_state)) {
+      LOG(LOG_ERROR, "%s was recorded by a different version", filename);
+      fclose(fp);
+      return NULL;
+   }
+
+   return stim_alloc(fp, hdr.chip, 0);
+}
+
+void stim_sync(struct stimulus* s, struct vicii_state* state) {
+   memcpy(&s->sync, state, sizeof(struct vicii_state));
+   s->hasSync = 1;
+}
+
+void stim_step(struct stimulus* s, struct vicii_state* state) {
+   s->in.addr_to_sim = state->addr_to_sim;
+   s->in.data_to_sim = state->data_to_sim;
+   s->in.ce = state->ce;
+   s->in.rw = state->rw;
+   s->in.lp = state->lp;
+   s->in.flags = state->flags & STIM_FLAGS;
+   s->in.vbank_phi1 = state->vice_vbank_phi1;
+   s->in.vbank_phi2 = state->vice_vbank_phi2;
+}
+
+static void read_out(struct stim_out* out, struct vicii_state* state) {
+   out->irq = state->irq;
+   out->ba = state->ba;
+   out->aec = state->aec;
+   out->phi = state->phi;
+   out->addr_from_sim = state->addr_from_sim;
+   out->data_from_sim = state->data_from_sim;
+   out->cycle_num = state->cycle_num;
+   out->raster_line = state->raster_line;
+   out->xpos = state->xpos;
+}
+
+void stim_result(struct stimulus* s, struct vicii_state* state) {
+   FILE* fp = s->fp;
+   struct stim_in* in = &s->in;
+   struct stim_in* li = &s->lastIn;
+   struct stim_out* out = &s->out;
+   struct stim_out* lo = &s->lastOut;
+
+   read_out(out, state);
+
+   if (s->hasSync) {
+      put8(fp, STIM_TAG_SYNC);
+      fwrite(&s->sync, sizeof(struct vicii_state), 1, fp);
+      s->hasSync = 0;
+   }
+
+   // The first step has nothing to be relative to
+   int all = s->steps == 0;
+   unsigned int inMask = 0;
+   if (all || in->addr_to_sim != li->addr_to_sim) inMask |= IN_ADDR;
+   if (all || in->data_to_sim != li->data_to_sim) inMask |= IN_DATA;
+   if (all || in->ce != li->ce) inMask |= IN_CE;
+   if (all || in->rw != li->rw) inMask |= IN_RW;
+   if (all || in->lp != li->lp) inMask |= IN_LP;
+   if (all || in->flags != li->flags) inMask |= IN_FLAGS;
+   if (all || in->vbank_phi1 != li->vbank_phi1 ||
+         in->vbank_phi2 != li->vbank_phi2)
+      inMask |= IN_VBANK;
+
+   unsigned int outMask = 0;
+   if (all || out->irq != lo->irq) outMask |= OUT_IRQ;
+   if (all || out->ba != lo->ba) outMask |= OUT_BA;
+   if (all || out->aec != lo->aec) outMask |= OUT_AEC;
+   if (all || out->phi != lo->phi) outMask |= OUT_PHI;
+   if (all || out->addr_from_sim != lo->addr_from_sim) outMask |= OUT_ADDR;
+   if (all || out->data_from_sim != lo->data_from_sim) outMask |= OUT_DATA;
+   if (all || out->cycle_num != lo->cycle_num ||
+         out->raster_line != lo->raster_line || out->xpos != lo->xpos)
+      outMask |= OUT_POS;
+
+   put8(fp, STIM_TAG_STEP | inMask);
+   put8(fp, outMask);
+   if (inMask & IN_ADDR) put16(fp, in->addr_to_sim);
+   if (inMask & IN_DATA) put16(fp, in->data_to_sim);
+   if (inMask & IN_CE) put8(fp, in->ce);
+   if (inMask & IN_RW) put8(fp, in->rw);
+   if (inMask & IN_LP) put8(fp, in->lp);
+   if (inMask & IN_FLAGS) put8(fp, in->flags);
+   if (inMask & IN_VBANK) {
+      put16(fp, in->vbank_phi1);
+      put16(fp, in->vbank_phi2);
+   }
+   if (outMask & OUT_IRQ) put8(fp, out->irq);
+   if (outMask & OUT_BA) put8(fp, out->ba);
+   if (outMask & OUT_AEC) put8(fp, out->aec);
+   if (outMask & OUT_PHI) put8(fp, out->phi);
+   if (outMask & OUT_ADDR) put16(fp, out->addr_from_sim);
+   if (outMask & OUT_DATA) put16(fp, out->data_from_sim);
+   if (outMask & OUT_POS) {
+      put8(fp, out->cycle_num);
+      put16(fp, out->raster_line);
+      put16(fp, out->xpos);
+   }
+
+   *li = *in;
+   *lo = *out;
+   s->steps++;
+}
+
+int stim_next(struct stimulus* s, struct vicii_state* state) {
+   FILE* fp = s->fp;
+   struct stim_in* in = &s->in;
+   struct stim_out* out = &s->out;
+   unsigned char tag, outMask, pos = 0;
+   int bad = 0;
+   int sync = 0;
+
+   if (get8(fp, &tag))
+      return 1;
+
+   if (tag == STIM_TAG_SYNC) {
+      if (fread(state, sizeof(struct vicii_state), 1, fp) != 1 ||
+             get8(fp, &tag)) {
+         LOG(LOG_ERROR, "stimulus log truncated after %ld steps", s->steps);
+         return 1;
+      }
+      sync = 1;
+   }
+
+   if ((tag & STIM_TAG_STEP) == 0 || get8(fp, &outMask)) {
+      LOG(LOG_ERROR, "bad stimulus record after %ld steps", s->steps);
+      return 1;
+   }
+
+   if (tag & IN_ADDR) bad |= get16(fp, &in->addr_to_sim);
+   if (tag & IN_DATA) bad |= get16(fp, &in->data_to_sim);
+   if (tag & IN_CE) bad |= get8(fp, &in->ce);
+   if (tag & IN_RW) bad |= get8(fp, &in->rw);
+   if (tag & IN_LP) bad |= get8(fp, &in->lp);
+   if (tag & IN_FLAGS) bad |= get8(fp, &in->flags);
+   if (tag & IN_VBANK) {
+      bad |= get16(fp, &in->vbank_phi1);
+      bad |= get16(fp, &in->vbank_phi2);
+   }
+   if (outMask & OUT_IRQ) bad |= get8(fp, &out->irq);
+   if (outMask & OUT_BA) bad |= get8(fp, &out->ba);
+   if (outMask & OUT_AEC) bad |= get8(fp, &out->aec);
+   if (outMask & OUT_PHI) bad |= get8(fp, &out->phi);
+   if (outMask & OUT_ADDR) bad |= get16(fp, &out->addr_from_sim);
+   if (outMask & OUT_DATA) bad |= get16(fp, &out->data_from_sim);
+   if (outMask & OUT_POS) {
+      bad |= get8(fp, &pos);
+      out->cycle_num = pos;
+      bad |= get16(fp, &out->raster_line);
+      bad |= get16(fp, &out->xpos);
+   }
+   if (bad) {
+      LOG(LOG_ERROR, "stimulus log truncated after %ld steps", s->steps);
+      return 1;
+   }
+
+   state->addr_to_sim = in->addr_to_sim;
+   state->data_to_sim = in->data_to_sim;
+   state->ce = in->ce;
+   state->rw = in->rw;
+   state->lp = in->lp;
+   state->flags = in->flags | (sync ? VICII_OP_SYNC_STATE : 0);
+   state->vice_vbank_phi1 = in->vbank_phi1;
+   state->vice_vbank_phi2 = in->vbank_phi2;
+
+   s->steps++;
+   return 0;
+}
+
+unsigned int stim_check(struct stimulus* s, struct vicii_state* state) {
+   struct stim_out now;
+   struct stim_out* out = &s->out;
+   read_out(&now, state);
+
+   unsigned int bad = 0;
+   if (now.irq != out->irq) bad |= BATCH_CHECK_IRQ;
+   if (now.ba != out->ba) bad |= BATCH_CHECK_BA;
+   if (now.aec != out->aec) bad |= BATCH_CHECK_AEC;
+   if (now.addr_from_sim != out->addr_from_sim) bad |= BATCH_CHECK_ADDR;
+   if (now.data_from_sim != out->data_from_sim) bad |= BATCH_CHECK_DATA;
+   return bad;
+}
+
+void stim_close(struct stimulus* s) {
+   fclose(s->fp);
+   free(s);
+}
@@ -0,0 +1,113 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_STIMULUS_H
+#define VICII_STIMULUS_H
+
+#include <stdio.h>
+
+extern "C" {
+#include "vicii_ipc.h"
+}
+
+// Record and replay of the bus traffic VICE sends while we shadow it.
+//
+// While recording, every step VICE asks for is logged with the inputs
+// it drove (address, data, ce, rw, lp, flags and the VIC bank it had
+// selected on each phase) and the outputs we gave
+// back.  Sync requests are logged with the whole vicii_state.  A replay
+// feeds the same steps to the model with no IPC at all and compares our
+// outputs against the recorded ones.  Only fields that changed since
+// the previous step are written so long sessions stay small.
+//
+// A replay only reproduces the recording if it starts from the same
+// model state (i.e. reset, or the same -R file).
+
+#define STIM_MAGIC 0x4d495453 // STIM
+#define STIM_VERSION 2
+
+struct stim_header {
+   unsigned int magic;
+   unsigned int version;
+   int chip;
+   unsigned int state_size;
+};
+
+struct stim_in {
+   unsigned short addr_to_sim;
+   unsigned short data_to_sim;
+   unsigned char ce;
+   unsigned char rw;
+   unsigned char lp;
+   unsigned char flags;
+   unsigned short vbank_phi1;
+   unsigned short vbank_phi2;
+};
+
+struct stim_out {
+   unsigned char irq;
+   unsigned char ba;
+   unsigned char aec;
+   unsigned char phi;
+   unsigned short addr_from_sim;
+   unsigned short data_from_sim;
+   unsigned short cycle_num;
+   unsigned short raster_line;
+   unsigned short xpos;
+};
+
+struct stimulus {
+   FILE* fp;
+   int chip;
+   long steps;
+   int recording;
+
+   // A sync request waiting to be written with its step
+   int hasSync;
+   struct vicii_state sync;
+
+   struct stim_in in;
+   struct stim_in lastIn;
+   struct stim_out out;
+   struct stim_out lastOut;
+};
+
+// Return NULL on error
+struct stimulus* stim_record(const char* filename, int chip);
+
+// Return NULL on error. The chip the log was recorded for is in chip.
+struct stimulus* stim_replay(const char* filename);
+
+// Recording: the state VICE sent with a sync request
+void stim_sync(struct stimulus* s, struct vicii_state* state);
+
+// Recording: the inputs for the step about to run
+void stim_step(struct stimulus* s, struct vicii_state* state);
+
+// Recording: our outputs at the end of the step
+void stim_result(struct stimulus* s, struct vicii_state* state);
+
+// Replay: load the next step into state as if VICE had sent it.
+// Return 1 at the end of the log, 0 otherwise
+int stim_next(struct stimulus* s, struct vicii_state* state);
+
+// Replay: compare our outputs against the recorded ones.
+// Return the BATCH_CHECK_* bits that differ
+unsigned int stim_check(struct stimulus* s, struct vicii_state* state);
+
+void stim_close(struct stimulus* s);
+
+#endif
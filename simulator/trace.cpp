@@ -0,0 +1,377 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "constants.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
+
+// Option parsing works in any build so -T/-U are always accepted
+int trace_parse_trigger(const char* spec, struct trace_trigger* trig) {
+   memset(trig, 0, sizeof(*trig));
+   if (strncmp(spec, "line:", 5) == 0) {
+      trig->type = TRIG_LINE;
+      if (sscanf(spec + 5, "%d:%d", &trig->line, &trig->cycle) < 1)
+         return 1;
+   } else if (strncmp(spec, "write:", 6) == 0) {
+      trig->type = TRIG_WRITE;
+      trig->reg = strtol(spec + 6, NULL, 16) & 0x3f;
+   } else if (strcmp(spec, "irq") == 0) {
+      trig->type = TRIG_IRQ;
+   } else if (strcmp(spec, "check") == 0) {
+      trig->type = TRIG_CHECK;
+   } else if (spec[0] == '+') {
+      trig->type = TRIG_CYCLES;
+      trig->cycles = atol(spec + 1);
+   } else {
+      return 1;
+   }
+   return 0;
+}
+
+#if VM_TRACE
+#if VM_TRACE_FST
+#include <verilated_fst_c.h>
+typedef VerilatedFstC TraceC;
+#else
+#include <verilated_vcd_c.h>
+typedef VerilatedVcdC TraceC;
+#endif
+
+#define TRACE_OFF   0
+#define TRACE_ARMED 1
+#define TRACE_ON    2
+#define TRACE_DONE  3
+
+// Segments kept in the pre-trigger ring. Each one is half the ring
+// so the oldest complete one can go while the newest fills.
+#define RING_SEGMENTS 3
+
+#if !VM_TRACE_FST
+
+// VCD output is handed to a thread in chunks of this size so the eval
+// loop doesn't wait on the disk. Only this many chunks can be queued;
+// if the disk can't keep up the simulation waits for room.
+#define WRITER_CHUNK (1 << 20)
+#define WRITER_QUEUE 16
+
+class AsyncWriter {
+ public:
+   bool open(const char* filename) {
+      fp = fopen(filename, "w");
+      if (!fp)
+         return false;
+      done = false;
+      thread = std::thread(&AsyncWriter::run, this);
+      return true;
+   }
+
+   bool isOpen() { return fp != nullptr; }
+
+   void write(const char* bufp, size_t len) {
+      chunk.append(bufp, len);
+      if (chunk.size() >= WRITER_CHUNK)
+         push();
+   }
+
+   void close() {
+      if (!fp)
+         return;
+      push();
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         done = true;
+      }
+      ready.notify_one();
+      thread.join();
+      fclose(fp);
+      fp = nullptr;
+   }
+
+ private:
+   FILE* fp = nullptr;
+   std::thread thread;
+   std::mutex mutex;
+   std::condition_variable ready;  // queue has a chunk or we're done
+   std::condition_variable room;   // queue has room
+   std::deque<std::string> queue;
+   std::string chunk;
+   bool done;
+
+   void push() {
+      if (chunk.empty())
+         return;
+      std::unique_lock<std::mutex> lock(mutex);
+      room.wait(lock, [this] { return queue.size() < WRITER_QUEUE; });
+      queue.emplace_back();
+      queue.back().swap(chunk);
+      lock.unlock();
+      ready.notify_one();
+   }
+
+   void run() {
+      for (;;) {
+         std::unique_lock<std::mutex> lock(mutex);
+         ready.wait(lock, [this] { return !queue.empty() || done; });
+         if (queue.empty())
+            return;
+         std::string out;
+         out.swap(queue.front());
+         queue.pop_front();
+         lock.unlock();
+         room.notify_one();
+         fwrite(out.data(), 1, out.size(), fp);
+      }
+   }
+};
+
+// Where the VCD writer's output goes. Until the start trigger the
+// ring keeps it in memory, one string per segment. After that it goes
+// to the file through the writer thread.
+class TraceFile : public VerilatedVcdFile {
+ public:
+   std::deque<std::string> segments;
+   std::string header;
+   AsyncWriter writer;
+   bool direct = false;
+
+   // Only the first segment has the header (signal definitions).
+   // Keep it apart so that segment can be dropped.
+   void takeHeader(std::string& s) {
+      size_t end = s.find("$enddefinitions $end");
+      if (end == std::string::npos)
+         return;
+      end = s.find('\n', end);
+      end = end == std::string::npos ? s.size() : end + 1;
+      if (header.empty())
+         header = s.substr(0, end);
+      s.erase(0, end);
+   }
+
+   bool open(const std::string& name) override {
+      if (direct)
+         return writer.open(name.c_str());
+      segments.emplace_back();
+      if (segments.size() > RING_SEGMENTS) {
+         takeHeader(segments.front());
+         segments.pop_front();
+      }
+      return true;
+   }
+
+   void close() override {
+      writer.close();
+   }
+
+   ssize_t write(const char* bufp, ssize_t len) override {
+      if (direct) {
+         if (writer.isOpen())
+            writer.write(bufp, len);
+      } else {
+         segments.back().append(bufp, len);
+      }
+      return len;
+   }
+
+   // Write out the ring as one VCD and carry on writing to the file.
+   // Every segment starts with a full dump so the oldest one we still
+   // have can follow the header.
+   bool commit(const char* filename) {
+      if (!writer.open(filename))
+         return false;
+      for (size_t i = 0; i < segments.size(); i++)
+         takeHeader(segments[i]);
+      writer.write(header.data(), header.size());
+      for (size_t i = 0; i < segments.size(); i++)
+         writer.write(segments[i].data(), segments[i].size());
+      segments.clear();
+      direct = true;
+      return true;
+   }
+};
+
+static TraceFile* traceFile;
+#endif
+
+static TraceC* tfp;
+static const char* traceName;
+static int traceState = TRACE_OFF;
+
+static struct trace_trigger startTrig;
+static struct trace_trigger stopTrig;
+static bool prevHit[2];
+
+static long segmentCycles;
+static long cyclesInSegment;
+static long cyclesOn;
+static int prevPhi;
+
+// Level of a trigger's condition. Triggers fire on its rising edge.
+static bool condition(struct trace_trigger* trig, Vtop* top) {
+   switch (trig->type) {
+      case TRIG_LINE:
+         return top->V_RASTER_LINE == trig->line &&
+                top->V_CYCLE_NUM == trig->cycle;
+      case TRIG_WRITE:
+         return !top->ce && !top->rw && (top->adl & 0x3f) == trig->reg;
+      case TRIG_IRQ:
+         return top->irq;
+      case TRIG_CYCLES:
+         return cyclesOn >= trig->cycles;
+      default:
+         return false;
+   }
+}
+
+static bool fired(int which, struct trace_trigger* trig, Vtop* top) {
+   bool hit = condition(trig, top);
+   bool rising = hit && !prevHit[which];
+   prevHit[which] = hit;
+   return rising;
+}
+
+static void startWindow(Vtop* top) {
+#if VM_TRACE_FST
+   tfp->open(traceName);
+#else
+   if (segmentCycles) {
+      tfp->flush();
+      if (!traceFile->commit(traceName)) {
+         LOG(LOG_ERROR, "can't write %s", traceName);
+         traceState = TRACE_DONE;
+         return;
+      }
+   } else {
+      traceFile->direct = true;
+      tfp->open(traceName);
+   }
+#endif
+   traceState = TRACE_ON;
+   cyclesOn = 0;
+   if (top)
+      LOG(LOG_INFO, "trace started at line %d cycle %d",
+          (int) top->V_RASTER_LINE, (int) top->V_CYCLE_NUM);
+}
+
+void trace_open(Vtop* top, const char* filename, struct trace_trigger* start,
+                struct trace_trigger* stop, long preCycles) {
+   Verilated::traceEverOn(true);  // Verilator must compute traced signals
+#if VM_TRACE_FST
+   // Verilator compresses and writes FST on its own thread(s)
+   tfp = new VerilatedFstC;
+   if (preCycles > 0) {
+      LOG(LOG_WARN, "pre-trigger ring needs a VCD build, ignoring -Y");
+      preCycles = 0;
+   }
+#else
+   traceFile = new TraceFile;
+   tfp = new VerilatedVcdC(traceFile);
+#endif
+   top->trace(tfp, 99);  // Trace 99 levels of hierarchy
+   traceName = filename;
+
+   if (start)
+      startTrig = *start;
+   if (stop)
+      stopTrig = *stop;
+
+   if (startTrig.type == TRIG_NONE) {
+      VL_PRINTF("verilog tracing into %s\n", filename);
+      startWindow(nullptr);
+      return;
+   }
+
+   VL_PRINTF("verilog tracing into %s when triggered\n", filename);
+   traceState = TRACE_ARMED;
+   if (preCycles > 0) {
+      segmentCycles = preCycles / (RING_SEGMENTS - 1);
+      if (segmentCycles == 0)
+         segmentCycles = 1;
+      tfp->open(filename);
+   }
+}
+
+void trace_dump(vluint64_t time) {
+   if (traceState == TRACE_ON || (traceState == TRACE_ARMED && segmentCycles)) {
+      uint64_t dumpStart = stats_begin();
+      tfp->dump(time);
+      stats_end(STAT_TRACE, dumpStart);
+   }
+}
+
+void trace_step(Vtop* top) {
+   if (traceState != TRACE_ARMED && traceState != TRACE_ON)
+      return;
+
+   bool phiRise = top->clk_phi && !prevPhi;
+   prevPhi = top->clk_phi;
+   if (phiRise && traceState == TRACE_ON)
+      cyclesOn++;
+
+   bool startHit = fired(0, &startTrig, top);
+   bool stopHit = fired(1, &stopTrig, top);
+
+   if (traceState == TRACE_ARMED) {
+      if (startHit) {
+         startWindow(top);
+      } else if (segmentCycles && phiRise &&
+                    ++cyclesInSegment >= segmentCycles) {
+#if !VM_TRACE_FST
+         // New segment, starts with a full dump
+         tfp->openNext(false);
+#endif
+         cyclesInSegment = 0;
+      }
+   } else if (stopHit) {
+      LOG(LOG_INFO, "trace stopped at line %d cycle %d after %ld cycles",
+          (int) top->V_RASTER_LINE, (int) top->V_CYCLE_NUM, cyclesOn);
+      tfp->close();
+      traceState = TRACE_DONE;
+   }
+}
+
+void trace_check_failed() {
+   if (traceState == TRACE_ARMED && segmentCycles)
+      startWindow(nullptr);
+   trace_close();
+}
+
+void trace_close() {
+   if (!tfp)
+      return;
+   if (traceState == TRACE_ARMED)
+      LOG(LOG_INFO, "trace trigger never fired, nothing written");
+   tfp->close();
+   traceState = TRACE_DONE;
+   delete tfp;
+   tfp = nullptr;
+#if !VM_TRACE_FST
+   delete traceFile;
+   traceFile = nullptr;
+#endif
+}
+
+#endif
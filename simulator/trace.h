@@ -0,0 +1,83 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_TRACE_H
+#define VICII_TRACE_H
+
+#include <verilated.h>
+
+#include "Vtop.h"
+
+// Windowed VCD/FST tracing.
+//
+// Without triggers (-t alone) every eval from reset is dumped as
+// before.  With a start trigger nothing is dumped until it fires so
+// the run goes at close to untraced speed.  A stop trigger (or a cycle
+// count) ends the window.  To see what led up to the trigger, the
+// last N phi cycles before it can be kept in a ring in memory.  The
+// ring is a few segments that each start with a full dump so the
+// oldest can be dropped and what's left still makes a valid VCD
+// (VCD builds only).
+//
+// Trigger specs:
+//    line:<n>[:<cycle>]  raster line n (at cycle, default 0)
+//    write:<reg>         CPU write to VIC register (hex, i.e. 11)
+//    irq                 IRQ asserted
+//    check               a CHECK failed (start only, the run ends)
+//    +<n>                n phi cycles after the start (stop only)
+
+// Models verilated with --trace-fst (make TRACE=fst) write FST
+#if VM_TRACE_FST
+#define TRACE_FILE "session.fst"
+#else
+#define TRACE_FILE "session.vcd"
+#endif
+
+#define TRIG_NONE   0
+#define TRIG_LINE   1
+#define TRIG_WRITE  2
+#define TRIG_IRQ    3
+#define TRIG_CHECK  4
+#define TRIG_CYCLES 5
+
+struct trace_trigger {
+   int type;
+   int line;
+   int cycle;
+   int reg;
+   long cycles;
+};
+
+// Return 1 on error, 0 success
+int trace_parse_trigger(const char* spec, struct trace_trigger* trig);
+
+// Set up tracing into filename. start/stop may be null. preCycles is
+// the depth of the pre-trigger ring (0 for none).
+void trace_open(Vtop* top, const char* filename, struct trace_trigger* start,
+                struct trace_trigger* stop, long preCycles);
+
+// Dump the model at time if inside the window (or filling the ring)
+void trace_dump(vluint64_t time);
+
+// Look at the model after an eval and open/close the window
+void trace_step(Vtop* top);
+
+// A CHECK failed. Writes out what the ring has before we exit.
+void trace_check_failed();
+
+void trace_close();
+
+#endif
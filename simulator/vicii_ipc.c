@@ -27,12 +27,151 @@
 #include <sys/sem.h>
 #include <sys/shm.h>
 #include <math.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <signal.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 #include "vicii_ipc.h"
 
 #define MODULE_NAME "ipc"
 
+// Spin transport. Each of the four semaphores becomes a pair of
+// counters in a shared memory segment of its own. The poster bumps
+// a counter and the waiter spins on it for a while before sleeping
+// on a futex, so a busy exchange never enters the kernel. Spinning
+// is pointless with a single cpu since the other side can't run
+// while we spin.
+#define SIGNALS_MAGIC 0x5350494e // SPIN
+#define SPIN_COUNT 4096
+
+struct ipc_signal {
+  atomic_uint posted;
+  atomic_uint waiting;
+} __attribute__((aligned(64)));
+
+struct ipc_signals {
+  unsigned int magic;
+  unsigned int transport;
+  unsigned int version;
+  struct ipc_signal signal[4] __attribute__((aligned(64)));
+};
+
+// The receiver's semaphores and segments (sems, buf, batch, signals).
+// They outlive the process unless removed, so if the receiver leaves
+// through exit() or dies on SIGINT/SIGTERM without calling ipc_close()
+// they are removed here. Only one receiver per process is tracked.
+static int receiverIds[4] = { -1, -1, -1, -1 };
+static int cleanupRegistered;
+static struct sigaction oldSigInt, oldSigTerm;
+
+static void remove_receiver_ids(void) {
+  if (receiverIds[0] >= 0)
+    semctl(receiverIds[0], 0, IPC_RMID);
+  for (int i = 1; i < 4; i++)
+    if (receiverIds[i] >= 0)
+      shmctl(receiverIds[i], IPC_RMID, NULL);
+  for (int i = 0; i < 4; i++)
+    receiverIds[i] = -1;
+}
+
+// Remove our objects, then do whatever was set up for the signal
+// before us (i.e. SDL turns SIGINT into a quit event)
+static void remove_on_signal(int sig, siginfo_t* info, void* context) {
+  remove_receiver_ids();
+  struct sigaction* old = sig == SIGINT ? &oldSigInt : &oldSigTerm;
+  if (old->sa_flags & SA_SIGINFO) {
+    old->sa_sigaction(sig, info, context);
+  } else if (old->sa_handler != SIG_DFL && old->sa_handler != SIG_IGN) {
+    old->sa_handler(sig);
+  } else {
+    sigaction(sig, old, NULL);
+    raise(sig);
+  }
+}
+
+static void catch_signal(int sig, struct sigaction* old) {
+  struct sigaction sa;
+  if (sigaction(sig, NULL, old) != 0 ||
+      (!(old->sa_flags & SA_SIGINFO) && old->sa_handler == SIG_IGN))
+    return;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = remove_on_signal;
+  sa.sa_flags = SA_SIGINFO;
+  sigemptyset(&sa.sa_mask);
+  sigaction(sig, &sa, NULL);
+}
+
+static void remove_on_exit(void) {
+  if (!cleanupRegistered) {
+    atexit(remove_receiver_ids);
+    catch_signal(SIGINT, &oldSigInt);
+    catch_signal(SIGTERM, &oldSigTerm);
+    cleanupRegistered = 1;
+  }
+}
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+#ifdef __linux__
+static void futex_wait(atomic_uint* addr, unsigned int val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+#else
+static void futex_wait(atomic_uint* addr, unsigned int val) {
+  sched_yield();
+}
+
+static void futex_wake(atomic_uint* addr) {
+}
+#endif
+
+static void spin_v(struct vicii_ipc* ipc, int semaphore) {
+  struct ipc_signal* slot = &ipc->signals->signal[semaphore];
+  atomic_fetch_add(&slot->posted, 1);
+  if (atomic_load(&slot->waiting))
+    futex_wake(&slot->posted);
+}
+
+static void spin_p(struct vicii_ipc* ipc, int semaphore) {
+  struct ipc_signal* slot = &ipc->signals->signal[semaphore];
+  unsigned int taken = ipc->taken[semaphore];
+
+  for (int i = 0; i < ipc->spinCount; i++) {
+    if (atomic_load_explicit(&slot->posted, memory_order_acquire) != taken)
+      goto done;
+    cpu_relax();
+  }
+
+  while (atomic_load(&slot->posted) == taken) {
+    atomic_store(&slot->waiting, 1);
+    // Re-check after announcing ourselves so a post can't slip by
+    if (atomic_load(&slot->posted) != taken)
+      break;
+    futex_wait(&slot->posted, taken);
+  }
+  atomic_store(&slot->waiting, 0);
+
+done:
+  ipc->taken[semaphore] = taken + 1;
+}
+
 static int v(struct vicii_ipc* ipc, int semaphore) {
+  if (ipc->transport == IPC_TRANSPORT_SPIN) {
+    spin_v(ipc, semaphore);
+    return 0;
+  }
   ipc->operation[semaphore][0].sem_num = semaphore;
   ipc->operation[semaphore][0].sem_op = 1;
   ipc->operation[semaphore][0].sem_flg = 0;
@@ -45,6 +184,10 @@ static int v(struct vicii_ipc* ipc, int semaphore) {
 }
 
 static int p(struct vicii_ipc* ipc, int semaphore) {
+  if (ipc->transport == IPC_TRANSPORT_SPIN) {
+    spin_p(ipc, semaphore);
+    return 0;
+  }
   ipc->operation[semaphore][0].sem_num = semaphore;
   ipc->operation[semaphore][0].sem_op = -1;
   ipc->operation[semaphore][0].sem_flg = 0;
@@ -56,12 +199,49 @@ static int p(struct vicii_ipc* ipc, int semaphore) {
   return 0;
 }
 
+// Derive a block of keys from an endpoint name (FNV-1a). Keys land
+// well away from the default ones and IPC_PRIVATE.
+static int name_to_key(const char* name) {
+   unsigned int h = 2166136261u;
+   for (const char* c = name; *c; c++) {
+      h ^= (unsigned char) *c;
+      h *= 16777619u;
+   }
+   return ((h & 0x0ffffffc) | 0x10000000);
+}
+
 struct vicii_ipc* ipc_init(int endPoint) {
+   return ipc_init_named(endPoint, getenv("VICII_IPC_NAME"));
+}
+
+struct vicii_ipc* ipc_init_named(int endPoint, const char* name) {
    struct vicii_ipc* ipc = (struct vicii_ipc*)
        malloc(sizeof(struct vicii_ipc));
    ipc->endPoint = endPoint;
-   ipc->semsKey = 1240;
-   ipc->bufKey = 1241;
+   if (name && *name) {
+      int key = name_to_key(name);
+      ipc->semsKey = key;
+      ipc->bufKey = key + 1;
+      ipc->batchKey = key + 2;
+      ipc->signalsKey = key + 3;
+   } else {
+      ipc->semsKey = 1240;
+      ipc->bufKey = 1241;
+      ipc->batchKey = 1242;
+      ipc->signalsKey = 1243;
+   }
+   ipc->transport = IPC_TRANSPORT_SEM;
+   ipc->signals = NULL;
+   memset(ipc->taken, 0, sizeof(ipc->taken));
+   ipc->spinCount = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_COUNT : 0;
+
+   // The receiver picks the transport. The sender follows whatever
+   // the receiver set up.
+   if (endPoint == IPC_RECEIVER) {
+      const char* transport = getenv("VICII_IPC_TRANSPORT");
+      if (transport && strcmp(transport, "spin") == 0)
+         ipc->transport = IPC_TRANSPORT_SPIN;
+   }
    return ipc;
 }
 
@@ -79,6 +259,10 @@ int ipc_open(struct vicii_ipc* ipc) {
     fprintf(stderr, "%s: can't create semaphore\n", MODULE_NAME);
     return -1;
   }
+  if (ipc->endPoint == IPC_RECEIVER) {
+    remove_on_exit();
+    receiverIds[0] = ipc->semsId;
+  }
 
   // If this is the originating end, set all semaphores to 0
   if (ipc->endPoint == IPC_RECEIVER) {
@@ -99,18 +283,74 @@ int ipc_open(struct vicii_ipc* ipc) {
     perror("REASON");
     return -1;
   }
+  if (ipc->endPoint == IPC_RECEIVER)
+    receiverIds[1] = ipc->bufShmId;
 
   ipc->state = (struct vicii_state*)shmat(ipc->bufShmId, NULL, 0);
   memset(ipc->state, 0, IPC_BUFSIZE);
   ipc->state->enabled = 1;
   ipc->state->rw = 1;
   ipc->state->ce = 1;
+  // Tells the receiver which layout the sender was built with
+  if (ipc->endPoint == IPC_SENDER)
+    ipc->state->version = VICII_STATE_VERSION;
 
   if (ipc->state == NULL) {
     fprintf(stderr, "%s: can't allocate dsp buffer\n", MODULE_NAME);
     return -1;
   }
 
+  ipc->batchShmId = shmget(ipc->batchKey, sizeof(struct vicii_batch),
+                           mode | 0644);
+  if (ipc->batchShmId < 0) {
+    fprintf(stderr, "%s: can't allocate shared memory segment for batch\n",
+            MODULE_NAME);
+    perror("REASON");
+    return -1;
+  }
+  if (ipc->endPoint == IPC_RECEIVER)
+    receiverIds[2] = ipc->batchShmId;
+
+  ipc->batch = (struct vicii_batch*)shmat(ipc->batchShmId, NULL, 0);
+  if (ipc->batch == (void*) -1) {
+    fprintf(stderr, "%s: can't attach batch buffer\n", MODULE_NAME);
+    return -1;
+  }
+  if (ipc->endPoint == IPC_RECEIVER) {
+    memset(ipc->batch, 0, sizeof(struct vicii_batch));
+  }
+
+  ipc->signalsShmId = shmget(ipc->signalsKey, sizeof(struct ipc_signals),
+                             mode | 0644);
+  if (ipc->signalsShmId < 0) {
+    fprintf(stderr, "%s: can't allocate shared memory segment for signals\n",
+            MODULE_NAME);
+    perror("REASON");
+    return -1;
+  }
+  if (ipc->endPoint == IPC_RECEIVER)
+    receiverIds[3] = ipc->signalsShmId;
+
+  ipc->signals = (struct ipc_signals*)shmat(ipc->signalsShmId, NULL, 0);
+  if (ipc->signals == (void*) -1) {
+    fprintf(stderr, "%s: can't attach signals\n", MODULE_NAME);
+    return -1;
+  }
+  if (ipc->endPoint == IPC_RECEIVER) {
+    memset(ipc->signals, 0, sizeof(struct ipc_signals));
+    ipc->signals->transport = ipc->transport;
+    ipc->signals->version = VICII_STATE_VERSION;
+    atomic_thread_fence(memory_order_release);
+    ipc->signals->magic = SIGNALS_MAGIC;
+  } else if (ipc->signals->magic == SIGNALS_MAGIC) {
+    if (ipc->signals->version != VICII_STATE_VERSION) {
+      fprintf(stderr, "%s: receiver uses state version %u, we use %u\n",
+              MODULE_NAME, ipc->signals->version, VICII_STATE_VERSION);
+      return -1;
+    }
+    ipc->transport = ipc->signals->transport;
+  }
+
   return 0;
 }
 
@@ -118,6 +358,16 @@ void ipc_close(struct vicii_ipc* ipc) {
   // Now free up all the memory and close handles
   shmdt(ipc->state);
   ipc->state = NULL;
+  shmdt(ipc->batch);
+  ipc->batch = NULL;
+  shmdt(ipc->signals);
+  ipc->signals = NULL;
+
+  // The receiver created the segments and semaphores so it removes
+  // them. Shared memory goes away once the sender detaches too.
+  if (ipc->endPoint == IPC_RECEIVER) {
+    remove_receiver_ids();
+  }
   free(ipc);
 }
 
@@ -144,6 +394,7 @@ int ipc_receive(struct vicii_ipc* ipc) {
       if (p(ipc, END2_PRODUCER_SIG_END1_CONSUME_OK))
          return 1;
     }
+    return 0;
 }
 
 int ipc_receive_done(struct vicii_ipc* ipc) {
@@ -50,6 +50,11 @@ union semun {
 #define VICII_OP_CAPTURE_ONE_FRAME 16
 // Abort
 #define VICII_OP_CAPTURE_ABORT   32
+// Step through every entry of the batch buffer before responding
+#define VICII_OP_BATCH           64
+// Set by the simulator in its last response when the request's version
+// doesn't match ours. It exits after responding.
+#define VICII_OP_VERSION_MISMATCH 128
 
 // Must not exceed IPC_BUFSIZE
 struct vicii_state {
@@ -116,6 +121,81 @@ struct vicii_state {
   // Used to adjust our address on bmm transition glitch
   int vice_vbank_phi1;
   int vice_vbank_phi2;
+
+  // VICII_STATE_VERSION of the sender, set by ipc_open. The simulator
+  // refuses requests from a different version and ipc_open fails on
+  // the sender side if the receiver's version differs.
+  unsigned int version;
+  // VICII_DIRTY_* groups the simulator changed while handling the
+  // current request. The simulator clears it when it picks up the next
+  // one, VICE never writes it.
+  unsigned int dirty;
+};
+
+// Version 2 adds the dirty mask. It flags the groups of fields the
+// simulator writes back after every step whose contents changed while
+// handling the request. It says nothing about VICE's side: a group
+// that isn't flagged can only be skipped if VICE's own values for it
+// didn't change since it last compared them either.
+#define VICII_STATE_VERSION 2
+
+#define VICII_DIRTY_REGS     1 // fpga_reg
+#define VICII_DIRTY_MATRIX   2 // vc, vc_base, rc, allow_bad_lines, reg11_delayed
+#define VICII_DIRTY_SPRITES  4 // mc, mcbase, ye_ff, sprite_dma
+#define VICII_DIRTY_CHAR_BUF 8 // fpga_char_buf
+
+// Batches let VICE hand over many steps per exchange. Each entry holds
+// the bus inputs for one step (what would otherwise be one ipc_send)
+// plus the outputs VICE expects. The simulator runs the entries in
+// order, records its outputs and stops early at the first entry that
+// does not match on a checked field. A batch can't be combined with
+// VICII_OP_SYNC_STATE, the simulator ignores it and leaves stop at 0.
+
+#define IPC_BATCH_MAX 1024
+
+// Fields of vicii_batch_in to compare
+#define BATCH_CHECK_IRQ  1
+#define BATCH_CHECK_BA   2
+#define BATCH_CHECK_AEC  4
+#define BATCH_CHECK_ADDR 8
+#define BATCH_CHECK_DATA 16
+
+struct vicii_batch_in {
+  unsigned short addr_to_sim;
+  unsigned short data_to_sim;
+  unsigned char ce;
+  unsigned char rw;
+  unsigned char lp;
+  unsigned char flags; // VICII_OP_BUS_ACCESS
+
+  // expected
+  unsigned char check; // BATCH_CHECK_*
+  unsigned char irq;
+  unsigned char ba;
+  unsigned char aec;
+  unsigned short addr_from_sim;
+  unsigned short data_from_sim;
+};
+
+struct vicii_batch_out {
+  unsigned char irq;
+  unsigned char ba;
+  unsigned char aec;
+  unsigned char phi;
+  unsigned short addr_from_sim;
+  unsigned short data_from_sim;
+  unsigned int cycle_num;
+  unsigned int raster_line;
+  unsigned int xpos;
+  unsigned char fpga_reg[64];
+};
+
+struct vicii_batch {
+  unsigned int count;    // entries in this batch, set by VICE
+  unsigned int stop;     // set by simulator: first mismatched entry or count
+  unsigned int mismatch; // BATCH_CHECK_* bits that failed at stop
+  struct vicii_batch_in in[IPC_BATCH_MAX];
+  struct vicii_batch_out out[IPC_BATCH_MAX];
 };
 
 #define END1_PRODUCER_SIG_END2_CONSUME_OK 0
@@ -128,6 +208,15 @@ struct vicii_state {
 
 #define IPC_BUFSIZE  1024
 
+// Transports. The receiver chooses one with the VICII_IPC_TRANSPORT
+// environment variable ("sem" or "spin") and the sender follows.
+// sem  : SysV semaphores, two kernel calls per exchange per side
+// spin : shared memory counters, spin then futex wait
+#define IPC_TRANSPORT_SEM  0
+#define IPC_TRANSPORT_SPIN 1
+
+struct ipc_signals;
+
 struct vicii_ipc {
   int endPoint;
   int semsKey;
@@ -137,14 +226,35 @@ struct vicii_ipc {
   int bufKey;
   int bufShmId;
 
+  int batchKey;
+  int batchShmId;
+  struct vicii_batch* batch;
+
+  int signalsKey;
+  int signalsShmId;
+  struct ipc_signals* signals;
+
+  int transport;
+  unsigned int taken[4];
+  int spinCount;
+
   struct vicii_state* state;
 };
 
 // IPC_RECEIVER must init first
 // IPC_SENDER sends a request and waits for a response
 // IPC_RECEIVER receives a request and sends a response
+// Uses the endpoint named by the VICII_IPC_NAME environment variable
+// if set, otherwise the default endpoint.
 struct vicii_ipc* ipc_init(int endPoint);
 
+// Both ends must use the same name. Every name gets its own semaphores
+// and shared memory so any number of pairs can run side by side.
+// NULL or "" is the default endpoint.
+struct vicii_ipc* ipc_init_named(int endPoint, const char* name);
+
+// The receiver's semaphores and shared memory are removed by ipc_close,
+// or at exit and on SIGINT/SIGTERM if it never gets there.
 int ipc_open(struct vicii_ipc* ipc);
 
 void ipc_close(struct vicii_ipc* ipc);
@@ -0,0 +1,227 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vsf.h"
+#include "log.h"
+
+#define VSF_MAGIC "VICE Snapshot File\032"
+#define VSF_MAGIC_LEN 19
+#define VSF_HEADER_LEN 58
+
+#define MODULE_NAME_LEN 16
+#define MODULE_HEADER_LEN 22
+
+// VIC-II module (viciisc, version 1.1)
+#define VIC_REGS        0x001
+#define VIC_CYCLE       0x041
+#define VIC_LINE        0x049
+#define VIC_IRQ_STATUS  0x04e
+#define VIC_IRQ_TRIGGER 0x053
+#define VIC_VBUF        0x054
+#define VIC_CBUF        0x07c
+#define VIC_COLOR_RAM   0x2f5
+#define VIC_SPRITES     0x6f5
+#define VIC_SPRITE_LEN  12
+#define VIC_MODULE_LEN  (VIC_SPRITES + 8 * VIC_SPRITE_LEN)
+
+// C64MEM module: port data, port ddr, exrom, game, then RAM
+#define MEM_RAM 4
+
+// Raster lines where idle, vborder and main_border are known from the
+// line alone: past the last line that can end a text row (the last
+// badline is $f7, its row ends with rc=7 in cycle 58 of $fe) and before
+// the first possible badline. The top and bottom border compares are
+// inside this range whatever RSEL and DEN are.
+#define VIC_FIRST_IDLE_LINE 0xff
+#define VIC_FIRST_BADLINE   0x30
+
+// CIA1/CIA2 modules
+#define CIA_SNAP_TA      4
+#define CIA_SNAP_TB      6
+#define CIA_SNAP_IMASK   13
+#define CIA_SNAP_CRA     14
+#define CIA_SNAP_CRB     15
+#define CIA_SNAP_TA_LATCH 16
+#define CIA_SNAP_TB_LATCH 18
+#define CIA_SNAP_IFR     20
+#define CIA_SNAP_LEN     21
+
+// MAINCPU module: clk, a, x, y, sp, pc, p
+#define CPU_SNAP_LEN 11
+
+struct vsf_module {
+   const unsigned char* data;
+   unsigned int size;
+};
+
+static unsigned int dword(const unsigned char* p) {
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+}
+
+static unsigned short word(const unsigned char* p) {
+   return p[0] | (p[1] << 8);
+}
+
+// Return 1 if the module isn't there or is too short
+static int find_module(const unsigned char* buf, long len, const char* name,
+                       unsigned int minSize, struct vsf_module* mod) {
+   long pos = VSF_HEADER_LEN;
+   while (pos + MODULE_HEADER_LEN <= len) {
+      const unsigned char* hdr = buf + pos;
+      unsigned int size = dword(hdr + MODULE_NAME_LEN + 2);
+      if (size < MODULE_HEADER_LEN || pos + size > len)
+         break;
+      if (strncmp((const char*) hdr, name, MODULE_NAME_LEN) == 0) {
+         if (size - MODULE_HEADER_LEN < minSize) {
+            LOG(LOG_ERROR, "snapshot module %s is too short", name);
+            return 1;
+         }
+         mod->data = hdr + MODULE_HEADER_LEN;
+         mod->size = size - MODULE_HEADER_LEN;
+         return 0;
+      }
+      pos += size;
+   }
+   LOG(LOG_ERROR, "snapshot has no %s module", name);
+   return 1;
+}
+
+static void load_cia(struct cia* t, const unsigned char* p) {
+   t->pra = p[0];
+   t->prb = p[1];
+   t->ddra = p[2];
+   t->ddrb = p[3];
+   t->ta = word(p + CIA_SNAP_TA);
+   t->tb = word(p + CIA_SNAP_TB);
+   t->imask = p[CIA_SNAP_IMASK] & 0x1f;
+   t->cra = p[CIA_SNAP_CRA];
+   t->crb = p[CIA_SNAP_CRB];
+   t->ta_latch = word(p + CIA_SNAP_TA_LATCH);
+   t->tb_latch = word(p + CIA_SNAP_TB_LATCH);
+   t->icr = p[CIA_SNAP_IFR] & 0x1f;
+   t->irq = (t->icr & t->imask) != 0;
+}
+
+// Return 1 if the snapshot is somewhere we can't set up
+static int load_vic(struct vicii_state* state, const unsigned char* p) {
+   memset(state, 0, sizeof(struct vicii_state));
+
+   memcpy(state->vice_reg, p + VIC_REGS, 64);
+   state->cycle_num = dword(p + VIC_CYCLE);
+   state->raster_line = dword(p + VIC_LINE);
+
+   if (state->raster_line >= VIC_FIRST_BADLINE &&
+          state->raster_line < VIC_FIRST_IDLE_LINE) {
+      LOG(LOG_ERROR, "snapshot taken on raster line %d, only lines from "
+          "%d to the end of the frame or before %d can be loaded",
+          state->raster_line, VIC_FIRST_IDLE_LINE, VIC_FIRST_BADLINE);
+      return 1;
+   }
+
+   unsigned char irq = p[VIC_IRQ_STATUS];
+   state->irst = irq & 1 ? 1 : 0;
+   state->imbc = irq & 2 ? 1 : 0;
+   state->immc = irq & 4 ? 1 : 0;
+   state->ilp = irq & 8 ? 1 : 0;
+   state->raster_irq_triggered = p[VIC_IRQ_TRIGGER];
+
+   memcpy(state->char_buf, p + VIC_VBUF, 40);
+   memcpy(state->color_buf, p + VIC_CBUF, 40);
+
+   // Each sprite: data (dword), mc, mcbase, pointer, y expand flop, x
+   for (int n = 0; n < 8; n++) {
+      const unsigned char* s = p + VIC_SPRITES + n * VIC_SPRITE_LEN;
+      state->mc[n] = s[4];
+      state->mcbase[n] = s[5];
+      state->ye_ff[n] = s[7];
+      state->sprite_dma[n] = s[5] != 63;
+   }
+
+   // Vertical border, checked above
+   state->idle = 1;
+   state->vborder = 1;
+   state->main_border = 1;
+   state->reg11_delayed = state->vice_reg[0x11];
+   return 0;
+}
+
+int vsf_load(const char* filename, struct vicii_state* state, struct c64* m) {
+   FILE* fp = fopen(filename, "rb");
+   if (fp == NULL) {
+      LOG(LOG_ERROR, "can't open %s", filename);
+      return 1;
+   }
+   fseek(fp, 0, SEEK_END);
+   long len = ftell(fp);
+   fseek(fp, 0, SEEK_SET);
+   if (len < 0) {
+      LOG(LOG_ERROR, "can't read %s", filename);
+      fclose(fp);
+      return 1;
+   }
+
+   unsigned char* buf = (unsigned char*) malloc(len);
+   if (fread(buf, 1, len, fp) != (size_t) len ||
+          len < VSF_HEADER_LEN || memcmp(buf, VSF_MAGIC, VSF_MAGIC_LEN) != 0) {
+      LOG(LOG_ERROR, "%s is not a VICE snapshot", filename);
+      free(buf);
+      fclose(fp);
+      return 1;
+   }
+   fclose(fp);
+
+   struct vsf_module vic, mem, cpu, cia1, cia2;
+   if (find_module(buf, len, "VIC-II", VIC_MODULE_LEN, &vic) ||
+          find_module(buf, len, "C64MEM", MEM_RAM + 65536, &mem) ||
+          find_module(buf, len, "MAINCPU", CPU_SNAP_LEN, &cpu) ||
+          find_module(buf, len, "CIA1", CIA_SNAP_LEN, &cia1) ||
+          find_module(buf, len, "CIA2", CIA_SNAP_LEN, &cia2)) {
+      free(buf);
+      return 1;
+   }
+
+   if (load_vic(state, vic.data)) {
+      free(buf);
+      return 1;
+   }
+   memcpy(m->color, vic.data + VIC_COLOR_RAM, sizeof(m->color));
+   for (int i = 0; i < 1024; i++)
+      m->color[i] &= 0x0f;
+
+   m->portData = mem.data[0];
+   m->portDdr = mem.data[1];
+   memcpy(m->ram, mem.data + MEM_RAM, 65536);
+
+   load_cia(&m->cia1, cia1.data);
+   load_cia(&m->cia2, cia2.data);
+
+   cpu_init(&m->cpu, word(cpu.data + 8));
+   m->cpu.a = cpu.data[4];
+   m->cpu.x = cpu.data[5];
+   m->cpu.y = cpu.data[6];
+   m->cpu.s = cpu.data[7];
+   m->cpu.p = cpu.data[10] | CPU_FLAG_U;
+
+   LOG(LOG_INFO, "%s: line %d cycle %d, pc $%04x", filename,
+       state->raster_line, state->cycle_num, m->cpu.pc);
+
+   free(buf);
+   return 0;
+}
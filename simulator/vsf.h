@@ -0,0 +1,40 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_VSF_H
+#define VICII_VSF_H
+
+#include "c64.h"
+
+extern "C" {
+#include "vicii_ipc.h"
+}
+
+// Reads a VICE (x64sc) .vsf snapshot.
+//
+// The VIC-II module is turned into the same vicii_state VICE sends with
+// a sync request so the registers go into the model the same way.  RAM,
+// color RAM, the CPU and both CIAs go into a c64 so the VIC has memory
+// to fetch from and the program carries on from where it was saved.
+// The VIC's internal state (idle, border flip flops, vc, rc, ...) is
+// not all in the snapshot in a form we can use.  It is only known for
+// snapshots taken in the vertical border, which is where VICE's tend
+// to be, and others are refused.
+
+// Return 1 on error, 0 success
+int vsf_load(const char* filename, struct vicii_state* state, struct c64* m);
+
+#endif
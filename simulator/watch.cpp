@@ -0,0 +1,114 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include "watch.h"
+
+struct watch {
+   const void* src;
+   int size;        // bytes
+   uint32_t mask;
+   int shift;       // of the mask's lowest bit
+   int pos;         // of the field in the word
+   int edges;       // callback edges, 0 for none
+   watch_fn fn;
+   void* arg;
+};
+
+uint64_t watchCur;
+uint64_t watchPrev;
+uint64_t watchEdges;
+uint64_t watchField[WATCH_MAX];
+
+static struct watch watches[WATCH_MAX];
+static int watchOrder[WATCH_MAX];    // ids in the order they were added
+static int numWatches;
+static int bitsUsed;
+static uint64_t callbackFields;      // fields of watches with callbacks
+static int fieldOwner[WATCH_BITS];   // id of the field at each bit
+
+static int add(int id, const void* src, int size, uint32_t mask) {
+   if (id < 0 || id >= WATCH_MAX || watches[id].src || mask == 0)
+      return 1;
+
+   int shift = __builtin_ctz(mask);
+   int width = 32 - __builtin_clz(mask) - shift;
+   if (bitsUsed + width > WATCH_BITS)
+      return 1;
+
+   struct watch* w = &watches[id];
+   w->src = src;
+   w->size = size;
+   w->mask = mask;
+   w->shift = shift;
+   w->pos = bitsUsed;
+   watchField[id] = (uint64_t) (mask >> shift) << bitsUsed;
+   for (int b = 0; b < width; b++)
+      fieldOwner[bitsUsed + b] = id;
+   bitsUsed += width;
+   watchOrder[numWatches++] = id;
+   return 0;
+}
+
+int watch_add(int id, const uint8_t* src, uint32_t mask) {
+   return add(id, src, 1, mask);
+}
+
+int watch_add(int id, const uint16_t* src, uint32_t mask) {
+   return add(id, src, 2, mask);
+}
+
+int watch_add(int id, const uint32_t* src, uint32_t mask) {
+   return add(id, src, 4, mask);
+}
+
+void watch_on(int id, int edges, watch_fn fn, void* arg) {
+   struct watch* w = &watches[id];
+   w->edges = edges;
+   w->fn = fn;
+   w->arg = arg;
+   if (edges && fn)
+      callbackFields |= watchField[id];
+   else
+      callbackFields &= ~watchField[id];
+}
+
+void watch_sample() {
+   uint64_t cur = 0;
+   for (int i = 0; i < numWatches; i++) {
+      struct watch* w = &watches[watchOrder[i]];
+      uint32_t v;
+      switch (w->size) {
+         case 1: v = *(const uint8_t*) w->src; break;
+         case 2: v = *(const uint16_t*) w->src; break;
+         default: v = *(const uint32_t*) w->src; break;
+      }
+      cur |= (uint64_t) ((v & w->mask) >> w->shift) << w->pos;
+   }
+   watchCur = cur;
+   watchEdges = cur ^ watchPrev;
+   if (watchEdges == 0)
+      return;
+
+   uint64_t hits = watchEdges & callbackFields;
+   while (hits) {
+      int id = fieldOwner[__builtin_ctzll(hits)];
+      struct watch* w = &watches[id];
+      hits &= ~watchField[id];
+      int edge = (cur & watchField[id]) ? WATCH_RISE : WATCH_FALL;
+      if (w->edges & edge)
+         w->fn(id, w->arg);
+   }
+}
@@ -0,0 +1,74 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_WATCH_H
+#define VICII_WATCH_H
+
+#include <stdint.h>
+
+// Edge detection for model signals.
+//
+// Each watched signal (masked and shifted down) gets its own field of
+// one 64 bit word.  watch_sample() packs the current value of every
+// watch into that word once per tick and a single XOR with the word
+// from the last watch_store() gives every change at once.  So adding a
+// watch costs a load and a shift per tick, nothing more.
+//
+// Callbacks can be registered on a watch's changes and are run from
+// watch_sample(), only on ticks where some watch changed.  A rise is a
+// change to a non-zero value and a fall is a change to zero.
+
+#define WATCH_MAX    16
+#define WATCH_BITS   64
+
+#define WATCH_RISE   1
+#define WATCH_FALL   2
+#define WATCH_CHANGE (WATCH_RISE | WATCH_FALL)
+
+typedef void (*watch_fn)(int id, void* arg);
+
+extern uint64_t watchCur;
+extern uint64_t watchPrev;
+extern uint64_t watchEdges;
+extern uint64_t watchField[WATCH_MAX];
+
+// Watch the bits of *src in mask as watch id. Returns non-zero if the
+// id is taken or out of range or the word has no room left.
+int watch_add(int id, const uint8_t* src, uint32_t mask);
+int watch_add(int id, const uint16_t* src, uint32_t mask);
+int watch_add(int id, const uint32_t* src, uint32_t mask);
+
+// Call fn on the given edges (WATCH_*) of watch id, 0 edges to stop
+void watch_on(int id, int edges, watch_fn fn, void* arg);
+
+// Read every watch, find what changed since watch_store() and run the
+// callbacks for those changes
+void watch_sample();
+
+// What watch_sample() read is what the next one compares against
+static inline void watch_store() {
+   watchPrev = watchCur;
+}
+
+static inline bool watch_changed(int id) {
+   return (watchEdges & watchField[id]) != 0;
+}
+
+static inline bool watch_high(int id) {
+   return (watchCur & watchField[id]) != 0;
+}
+
+#endif
@@ -32,6 +32,18 @@ public class MakeReport
 		System.out.println("<td>");
 		System.out.println("<a target=_blank href=\""+web_dir+"/fpga_"+fn+".png\"><img src=\""+web_dir+"/fpga_"+fn+".png\"></img></a>");
 		System.out.println("</td>");
+
+        File f3 = new File(d+"/diff_"+fn+".txt");
+	if (f3.exists()) {
+           BufferedReader br3 = new BufferedReader(new FileReader(f3));
+           String l3 = br3.readLine();
+           br3.close();
+		System.out.println("<td>");
+		System.out.println("<a target=_blank href=\""+web_dir+"/diff_"+fn+".png\"><img src=\""+web_dir+"/diff_"+fn+".png\"></img></a>");
+		System.out.println("<br>");
+		System.out.println(l3 == null ? "" : l3.split(" ")[0]);
+		System.out.println("</td>");
+	}
 		System.out.println("<td>");
 		System.out.println("<textarea rows=\"10\" cols=\"50\">");
 
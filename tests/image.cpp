@@ -0,0 +1,107 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image.h"
+
+static int loadPpm(const char* filename, struct image* img) {
+   FILE* fp = fopen(filename, "rb");
+   if (fp == NULL)
+      return 1;
+   int maxval;
+   if (fscanf(fp, "P6 %d %d %d", &img->width, &img->height, &maxval) != 3 ||
+          maxval != 255) {
+      fclose(fp);
+      return 1;
+   }
+   fgetc(fp);
+   size_t n = (size_t) img->width * img->height;
+   unsigned char* rgb = (unsigned char*) malloc(n * 3);
+   int rc = fread(rgb, 3, n, fp) != n;
+   fclose(fp);
+   if (rc) {
+      free(rgb);
+      return 1;
+   }
+   img->pixels = (uint32_t*) malloc(n * 4);
+   for (size_t i = 0; i < n; i++)
+      img->pixels[i] = 0xff000000u | (rgb[i * 3] << 16) |
+                       (rgb[i * 3 + 1] << 8) | rgb[i * 3 + 2];
+   free(rgb);
+   return 0;
+}
+
+static int loadPng(const char* filename, struct image* img) {
+   png_image png;
+   memset(&png, 0, sizeof(png));
+   png.version = PNG_IMAGE_VERSION;
+   if (!png_image_begin_read_from_file(&png, filename))
+      return 1;
+   // BGRA in memory is 0xAARRGGBB as a little endian word
+   png.format = PNG_FORMAT_BGRA;
+   img->width = png.width;
+   img->height = png.height;
+   img->pixels = (uint32_t*) malloc(PNG_IMAGE_SIZE(png));
+   if (!png_image_finish_read(&png, NULL, img->pixels, 0, NULL)) {
+      png_image_free(&png);
+      image_free(img);
+      return 1;
+   }
+   return 0;
+}
+
+int image_load(const char* filename, struct image* img) {
+   const char* ext = strrchr(filename, '.');
+   img->pixels = NULL;
+   return ext && strcmp(ext, ".ppm") == 0 ? loadPpm(filename, img)
+                                          : loadPng(filename, img);
+}
+
+int image_save_png(const char* filename, const struct image* img) {
+   png_image png;
+   memset(&png, 0, sizeof(png));
+   png.version = PNG_IMAGE_VERSION;
+   png.width = img->width;
+   png.height = img->height;
+   png.format = PNG_FORMAT_BGRA;
+   return !png_image_write_to_file(&png, filename, 0, img->pixels, 0, NULL);
+}
+
+void image_scale(struct image* img, int w, int h) {
+   if (img->width == w && img->height == h)
+      return;
+   uint32_t* dst = (uint32_t*) malloc((size_t) w * h * 4);
+   for (int y = 0; y < h; y++) {
+      const uint32_t* row = img->pixels + (size_t) (y * img->height / h) *
+                            img->width;
+      for (int x = 0; x < w; x++)
+         dst[(size_t) y * w + x] = row[x * img->width / w];
+   }
+   free(img->pixels);
+   img->pixels = dst;
+   img->width = w;
+   img->height = h;
+}
+
+void image_free(struct image* img) {
+   free(img->pixels);
+   img->pixels = NULL;
+}
@@ -0,0 +1,44 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef VICII_TEST_IMAGE_H
+#define VICII_TEST_IMAGE_H
+
+#include <stdint.h>
+
+// Image files for the test tools (run_tests, imgdiff). PNGs go through
+// libpng, PPMs are the binary ones the simulator writes.
+
+struct image {
+   int width;
+   int height;
+   uint32_t* pixels;   // 0xAARRGGBB
+};
+
+// Load a .ppm or otherwise a png. Returns non-zero (and no pixels) on
+// error.
+int image_load(const char* filename, struct image* img);
+
+// Returns non-zero on error
+int image_save_png(const char* filename, const struct image* img);
+
+// Point sample to w x h, as convert -filter point does
+void image_scale(struct image* img, int w, int h);
+
+void image_free(struct image* img);
+
+#endif
@@ -0,0 +1,350 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Compares a VICE frame with an FPGA frame.
+//
+// Both images are scaled (point sampling, as convert -filter point did)
+// to the chip's native frame size, one pixel per dot and one row per
+// raster line.  Then every row is compared with the widest kernel the
+// cpu has.  Prints the mismatch count, the first raster line and cycle
+// that differ and the bounding box of each region of differences.  Can
+// also write a mask image that shows the differences in red over a
+// dimmed copy of the FPGA frame.
+//
+// Exit status is 0 if the frames match, 1 if they don't and 2 on error.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define MAX_REGIONS 16
+
+// Rows with differences that are this close together are one region
+#define REGION_GAP 4
+
+// Channels are compared without alpha
+#define RGB_MASK 0x00ffffffu
+
+struct region {
+   int x0, y0;
+   int x1, y1;
+   long pixels;
+};
+
+struct standard {
+   const char* name;
+   int width;
+   int height;
+   int cycles;
+};
+
+static const struct standard standards[] = {
+   { "NTSC",    520, 263, 65 },
+   { "PAL",     504, 312, 63 },
+   { "NTSCOLD", 512, 262, 64 },
+};
+
+// Compare n pixels of a with b and set mask[i] to 0xff where any
+// channel differs by more than tol, 0 otherwise. Returns the number
+// of pixels that differ.
+typedef int (*diff_fn)(const uint32_t* a, const uint32_t* b,
+                       uint8_t* mask, int n, uint8_t tol);
+
+static int diffScalar(const uint32_t* a, const uint32_t* b,
+                      uint8_t* mask, int n, uint8_t tol) {
+   int count = 0;
+   for (int i = 0; i < n; i++) {
+      uint32_t pa = a[i], pb = b[i];
+      int differs = 0;
+      for (int s = 0; s < 24; s += 8) {
+         int ca = (pa >> s) & 0xff;
+         int cb = (pb >> s) & 0xff;
+         if (abs(ca - cb) > tol)
+            differs = 1;
+      }
+      mask[i] = differs ? 0xff : 0;
+      count += differs;
+   }
+   return count;
+}
+
+#ifdef HAVE_X86
+
+// 4 bits from a movemask to 4 mask bytes
+static uint32_t lut4[16];
+// 8 bits to 8 mask bytes
+static uint64_t lut8[256];
+
+static void initLuts() {
+   for (int m = 0; m < 256; m++) {
+      uint64_t v = 0;
+      for (int i = 0; i < 8; i++)
+         if (m & (1 << i))
+            v |= (uint64_t) 0xff << (i * 8);
+      lut8[m] = v;
+      if (m < 16)
+         lut4[m] = (uint32_t) v;
+   }
+}
+
+static int diffSse2(const uint32_t* a, const uint32_t* b,
+                    uint8_t* mask, int n, uint8_t tol) {
+   const __m128i tolv = _mm_set1_epi8((char) tol);
+   const __m128i rgb = _mm_set1_epi32(RGB_MASK);
+   const __m128i zero = _mm_setzero_si128();
+   int count = 0;
+   int i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i va = _mm_loadu_si128((const __m128i*) (a + i));
+      __m128i vb = _mm_loadu_si128((const __m128i*) (b + i));
+      // |a - b| per channel, then whatever is left above tol
+      __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+      d = _mm_and_si128(_mm_subs_epu8(d, tolv), rgb);
+      int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(d, zero)));
+      int bits = ~same & 0xf;
+      memcpy(mask + i, &lut4[bits], 4);
+      count += __builtin_popcount(bits);
+   }
+   return count + diffScalar(a + i, b + i, mask + i, n - i, tol);
+}
+
+__attribute__((target("avx2")))
+static int diffAvx2(const uint32_t* a, const uint32_t* b,
+                    uint8_t* mask, int n, uint8_t tol) {
+   const __m256i tolv = _mm256_set1_epi8((char) tol);
+   const __m256i rgb = _mm256_set1_epi32(RGB_MASK);
+   const __m256i zero = _mm256_setzero_si256();
+   int count = 0;
+   int i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+      __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+      __m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb),
+                                  _mm256_subs_epu8(vb, va));
+      d = _mm256_and_si256(_mm256_subs_epu8(d, tolv), rgb);
+      int same = _mm256_movemask_ps(
+          _mm256_castsi256_ps(_mm256_cmpeq_epi32(d, zero)));
+      int bits = ~same & 0xff;
+      memcpy(mask + i, &lut8[bits], 8);
+      count += __builtin_popcount(bits);
+   }
+   return count + diffSse2(a + i, b + i, mask + i, n - i, tol);
+}
+
+#endif
+
+static diff_fn pickKernel(const char** name) {
+#ifdef HAVE_X86
+   initLuts();
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2")) {
+      *name = "avx2";
+      return diffAvx2;
+   }
+   if (__builtin_cpu_supports("sse2")) {
+      *name = "sse2";
+      return diffSse2;
+   }
+#endif
+   *name = "scalar";
+   return diffScalar;
+}
+
+// ------------------------------------------------------------- images
+
+static int loadImage(const char* filename, struct image* img) {
+   int rc = image_load(filename, img);
+   if (rc)
+      fprintf(stderr, "can't read %s\n", filename);
+   return rc;
+}
+
+static int savePng(const char* filename, const struct image* img) {
+   if (image_save_png(filename, img)) {
+      fprintf(stderr, "can't write %s\n", filename);
+      return 1;
+   }
+   return 0;
+}
+
+// ------------------------------------------------------------- main
+
+static void usage() {
+   printf("Usage: imgdiff [options] <vice image> <fpga image>\n");
+   printf("  -s <std>  : PAL (default), NTSC or NTSCOLD\n");
+   printf("  -t <n>    : allowed difference per channel (default 0)\n");
+   printf("  -d <file> : write a png mask of the differences\n");
+   printf("  -k <name> : force kernel scalar, sse2 or avx2\n");
+   printf("  -q        : only set the exit status\n");
+   printf("Images are png or ppm.\n");
+}
+
+int main(int argc, char** argv) {
+   const struct standard* std = &standards[1];
+   const char* maskFile = nullptr;
+   const char* kernelName = nullptr;
+   int tol = 0;
+   bool quiet = false;
+
+   int c;
+   while ((c = getopt(argc, argv, "hs:t:d:k:q")) != -1) {
+      switch (c) {
+         case 's':
+            std = nullptr;
+            for (unsigned i = 0; i < sizeof(standards) / sizeof(standards[0]); i++)
+               if (strcmp(optarg, standards[i].name) == 0)
+                  std = &standards[i];
+            if (!std) {
+               fprintf(stderr, "unknown standard %s\n", optarg);
+               return 2;
+            }
+            break;
+         case 't': tol = atoi(optarg); break;
+         case 'd': maskFile = optarg; break;
+         case 'k': kernelName = optarg; break;
+         case 'q': quiet = true; break;
+         case 'h':
+            usage();
+            return 0;
+         default:
+            usage();
+            return 2;
+      }
+   }
+   if (argc - optind != 2 || tol < 0 || tol > 255) {
+      usage();
+      return 2;
+   }
+
+   const char* name;
+   diff_fn diff = pickKernel(&name);
+   if (kernelName && strcmp(kernelName, name) != 0) {
+      if (strcmp(kernelName, "scalar") == 0)
+         diff = diffScalar;
+#ifdef HAVE_X86
+      else if (strcmp(kernelName, "sse2") == 0)
+         diff = diffSse2;
+#endif
+      else {
+         fprintf(stderr, "kernel %s not available\n", kernelName);
+         return 2;
+      }
+      name = kernelName;
+   }
+
+   struct image vice, fpga;
+   if (loadImage(argv[optind], &vice) || loadImage(argv[optind + 1], &fpga))
+      return 2;
+   image_scale(&vice, std->width, std->height);
+   image_scale(&fpga, std->width, std->height);
+
+   int w = std->width;
+   int h = std->height;
+   uint8_t* mask = (uint8_t*) malloc((size_t) w * h);
+
+   struct region regions[MAX_REGIONS];
+   int numRegions = 0;
+   bool regionsFull = false;
+   long total = 0;
+   int firstLine = -1, firstX = -1;
+   int lastRow = -REGION_GAP - 1;
+
+   for (int y = 0; y < h; y++) {
+      uint8_t* m = mask + (size_t) y * w;
+      int n = diff(vice.pixels + (size_t) y * w, fpga.pixels + (size_t) y * w,
+                   m, w, tol);
+      if (n == 0)
+         continue;
+      total += n;
+
+      int x0 = 0, x1 = w - 1;
+      while (!m[x0]) x0++;
+      while (!m[x1]) x1--;
+      if (firstLine < 0) {
+         firstLine = y;
+         firstX = x0;
+      }
+
+      struct region* r = numRegions ? &regions[numRegions - 1] : nullptr;
+      if (r && y - lastRow <= REGION_GAP) {
+         if (x0 < r->x0) r->x0 = x0;
+         if (x1 > r->x1) r->x1 = x1;
+         r->y1 = y;
+         r->pixels += n;
+      } else if (numRegions < MAX_REGIONS) {
+         r = &regions[numRegions++];
+         r->x0 = x0;
+         r->x1 = x1;
+         r->y0 = r->y1 = y;
+         r->pixels = n;
+      } else {
+         // The last region soaks up the rest
+         regionsFull = true;
+         if (x0 < r->x0) r->x0 = x0;
+         if (x1 > r->x1) r->x1 = x1;
+         r->y1 = y;
+         r->pixels += n;
+      }
+      lastRow = y;
+   }
+
+   if (maskFile) {
+      // Differences in red over a dimmed grey copy of the fpga frame
+      for (size_t i = 0; i < (size_t) w * h; i++) {
+         uint32_t p = fpga.pixels[i];
+         if (mask[i]) {
+            fpga.pixels[i] = 0xffff0000u;
+         } else {
+            uint32_t g = (((p >> 16) & 0xff) + ((p >> 8) & 0xff) +
+                          (p & 0xff)) / 12;
+            fpga.pixels[i] = 0xff000000u | (g << 16) | (g << 8) | g;
+         }
+      }
+      if (savePng(maskFile, &fpga))
+         return 2;
+   }
+
+   if (!quiet) {
+      printf("%s pixels=%ld of %d standard=%s kernel=%s tolerance=%d\n",
+             total ? "FAIL" : "PASS", total, w * h, std->name, name, tol);
+      if (total) {
+         // One cycle is 8 dots
+         printf("first line=%d cycle=%d x=%d\n", firstLine,
+                firstX * std->cycles / w, firstX);
+         for (int i = 0; i < numRegions; i++) {
+            struct region* r = &regions[i];
+            printf("region lines=%d-%d x=%d-%d cycles=%d-%d pixels=%ld%s\n",
+                   r->y0, r->y1, r->x0, r->x1, r->x0 * std->cycles / w,
+                   r->x1 * std->cycles / w, r->pixels,
+                   regionsFull && i == numRegions - 1 ? " (and the rest)" : "");
+         }
+      }
+   }
+
+   free(mask);
+   image_free(&vice);
+   image_free(&fpga);
+   return total ? 1 : 0;
+}
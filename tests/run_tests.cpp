@@ -0,0 +1,654 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Runs the tests listed in tests.txt, many at a time.
+//
+// Standalone (default): the simulator runs each program on its built in
+// CPU (-P, or -V for snapshots) for a number of frames and writes the
+// last one.  No VICE and nothing shared between tests.
+//
+// VICE: x64sc and the simulator shadow each other as test_all.sh does,
+// but each pair gets its own IPC name (VICII_IPC_NAME) and its own
+// working directory so they can run side by side.  VICE gives us no
+// frame trigger so the program still gets a warmup in real time before
+// the capture starts.
+//
+// Each test leaves fpga_<prg>.png (and the logs) next to its prg like
+// test_all.sh did and a summary of every test goes to a JSON file.
+// Standalone runs also collect every frame's hashes in one file.  Give
+// that file back as a golden manifest (-g) and only frames that differ
+// from it are kept as images.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "image.h"
+
+#define MAX_TESTS 1024
+#define MAX_ARGS 32
+
+#define MODE_STANDALONE 0
+#define MODE_VICE       1
+
+enum {
+   ST_PENDING, ST_RUNNING, ST_PASS, ST_FAIL, ST_TIMEOUT
+};
+
+static const char* statusName[] = {
+   "pending", "running", "pass", "fail", "timeout"
+};
+
+struct test {
+   char path[256];     // relative to the tests dir
+   char standard[16];  // PAL, NTSC, NTSCOLD
+   int chip;
+   int width;          // what the png is scaled to
+   int height;
+   int frames;         // standalone: frames to run
+   int warmup;         // vice: seconds before capture
+
+   int status;
+   bool hasImage;
+   char reason[128];
+   double start;
+   double seconds;
+};
+
+struct job {
+   struct test* t;
+   char dir[64];
+   pid_t sim;
+   pid_t vice;
+   double viceStarted;
+   double simDone;
+   int simStatus;
+};
+
+static struct test tests[MAX_TESTS];
+static int numTests;
+
+static int mode = MODE_STANDALONE;
+static int numWorkers = 0;
+static int timeoutSecs = 600;
+static int shardIndex = 0;
+static int shardCount = 1;
+static const char* listFile = "tests.txt";
+static const char* summaryFile = "results.json";
+static const char* hashFile = "hashes.txt";
+static const char* goldenFile = nullptr;
+static FILE* hashOut;
+static const char* simPath = "../simulator/obj_dir/Vtop";
+static const char* hdlDir = "../hdl";
+static const char* romDir = nullptr;
+static const char* viceDir = nullptr;
+static char testsDir[512];
+
+static double now() {
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// ------------------------------------------------------------- tests
+
+// Seconds to let a program run before we take its picture, the same
+// delays test_all.sh sleeps for.
+static int delayFor(const char* path) {
+   if (strstr(path, "spritecrunch")) return 8;
+   if (strstr(path, "reg_timing")) return 14;
+   if (strstr(path, "lightpen")) return 16;
+   if (strstr(path, "lft-safe-vsp") || strstr(path, "spritescan") ||
+         strstr(path, "sprite0move") || strstr(path, "spritevssprite"))
+      return 19;
+   return 6;
+}
+
+// Frames the chip shows in secs seconds (dot clock / 8 / cycles per
+// line / lines)
+static int secondsToFrames(int chip, int secs) {
+   double fps;
+   switch (chip) {
+      case 0: fps = 8181818.0 / 8 / 65 / 263; break;  // 6567R8
+      case 2: fps = 8181818.0 / 8 / 64 / 262; break;  // 6567R56A
+      default: fps = 7881984.0 / 8 / 63 / 312; break; // 6569
+   }
+   return (int) (secs * fps + 0.5);
+}
+
+static int loadTests(char** filters, int numFilters) {
+   FILE* fp = fopen(listFile, "r");
+   if (fp == NULL) {
+      fprintf(stderr, "can't open %s\n", listFile);
+      return 1;
+   }
+
+   char line[512];
+   int index = 0;
+   while (fgets(line, sizeof(line), fp) && numTests < MAX_TESTS) {
+      char path[256], standard[16];
+      int frames = 0;
+      int n = sscanf(line, "%255s %15s %*s %d", path, standard, &frames);
+      if (n < 1)
+         continue;
+      if (n < 2)
+         strcpy(standard, "PAL");
+
+      if (numFilters > 0) {
+         int match = 0;
+         for (int i = 0; i < numFilters; i++)
+            if (strstr(path, filters[i]))
+               match = 1;
+         if (!match)
+            continue;
+      }
+
+      // Shards split the list the same way on every machine
+      if (index++ % shardCount != shardIndex)
+         continue;
+
+      struct test* t = &tests[numTests++];
+      memset(t, 0, sizeof(*t));
+      strcpy(t->path, path);
+      strcpy(t->standard, standard);
+      if (strcmp(standard, "NTSC") == 0) {
+         t->chip = 0;
+         t->width = 520;
+         t->height = 263;
+      } else if (strcmp(standard, "NTSCOLD") == 0) {
+         t->chip = 2;
+         t->width = 512;
+         t->height = 262;
+      } else {
+         t->chip = 1;
+         t->width = 512;
+         t->height = 312;
+      }
+      // An optional 4th column overrides the frame count
+      t->warmup = delayFor(path);
+      t->frames = n == 3 && frames > 0 ? frames :
+                     secondsToFrames(t->chip, t->warmup);
+      t->status = ST_PENDING;
+   }
+   fclose(fp);
+   return 0;
+}
+
+// Output file next to the test, i.e. VICII/border/fpga_border-250.prg.png
+static void outputName(char* buf, size_t len, struct test* t,
+                       const char* prefix, const char* ext) {
+   const char* slash = strrchr(t->path, '/');
+   if (slash)
+      snprintf(buf, len, "%.*s/%s%s%s", (int) (slash - t->path), t->path,
+               prefix, slash + 1, ext);
+   else
+      snprintf(buf, len, "%s%s%s", prefix, t->path, ext);
+}
+
+// ------------------------------------------------------------- jobs
+
+// Fork and exec argv in dir with output going to logFile
+static pid_t spawn(const char* dir, char* const argv[], const char* logFile,
+                   const char* ipcName) {
+   pid_t pid = fork();
+   if (pid != 0)
+      return pid;
+
+   if (chdir(dir) != 0)
+      _exit(127);
+   int fd = open(logFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd >= 0) {
+      dup2(fd, 1);
+      dup2(fd, 2);
+      close(fd);
+   }
+   if (ipcName)
+      setenv("VICII_IPC_NAME", ipcName, 1);
+   execvp(argv[0], argv);
+   _exit(127);
+}
+
+// The simulator loads its .bin tables from the working directory
+static void linkTables(const char* dir) {
+   char pattern[512];
+   snprintf(pattern, sizeof(pattern), "%s/*.bin", hdlDir);
+   glob_t g;
+   if (glob(pattern, 0, NULL, &g) != 0)
+      return;
+   for (size_t i = 0; i < g.gl_pathc; i++) {
+      char target[1024], link[512];
+      const char* base = strrchr(g.gl_pathv[i], '/') + 1;
+      if (realpath(g.gl_pathv[i], target) == NULL)
+         continue;
+      snprintf(link, sizeof(link), "%s/%s", dir, base);
+      if (symlink(target, link) != 0 && errno != EEXIST)
+         perror(link);
+   }
+   globfree(&g);
+}
+
+static void startSim(struct job* j) {
+   struct test* t = j->t;
+   char chip[8], frames[16], prg[1024], log[1024];
+   char* argv[MAX_ARGS];
+   int argc = 0;
+
+   snprintf(chip, sizeof(chip), "%d", t->chip);
+   snprintf(frames, sizeof(frames), "%d", t->frames);
+   snprintf(prg, sizeof(prg), "%s/%s", testsDir, t->path);
+   snprintf(log, sizeof(log), "%s/sim.log", j->dir);
+
+   argv[argc++] = (char*) simPath;
+   argv[argc++] = (char*) "-k";
+   argv[argc++] = (char*) "-c";
+   argv[argc++] = chip;
+   argv[argc++] = (char*) "-o";
+   argv[argc++] = (char*) "capture.ppm";
+   if (mode == MODE_VICE) {
+      argv[argc++] = (char*) "-z";
+      argv[argc++] = (char*) "-x";
+      argv[argc++] = (char*) "-I";
+      argv[argc++] = j->dir + 5;
+   } else {
+      argv[argc++] = (char*) (strstr(t->path, ".vsf") ? "-V" : "-P");
+      argv[argc++] = prg;
+      argv[argc++] = (char*) "-n";
+      argv[argc++] = frames;
+      if (romDir) {
+         argv[argc++] = (char*) "-K";
+         argv[argc++] = (char*) romDir;
+      }
+      argv[argc++] = (char*) "-N";
+      argv[argc++] = t->path;
+      argv[argc++] = (char*) "-H";
+      argv[argc++] = (char*) "hashes.txt";
+      if (goldenFile) {
+         argv[argc++] = (char*) "-G";
+         argv[argc++] = (char*) goldenFile;
+      }
+   }
+   argv[argc] = NULL;
+
+   j->sim = spawn(j->dir, argv, log, NULL);
+}
+
+static void startVice(struct job* j) {
+   struct test* t = j->t;
+   char exe[1024], prg[1024], log[1024];
+   const char* standard = "-pal";
+   const char* model = "6569";
+
+   if (t->chip == 0) {
+      standard = "-ntsc";
+      model = "6567";
+   } else if (t->chip == 2) {
+      standard = "-ntsc";
+      model = "6567r56a";
+   }
+
+   snprintf(exe, sizeof(exe), "%s/src/x64sc", viceDir);
+   snprintf(prg, sizeof(prg), "%s/%s", testsDir, t->path);
+   snprintf(log, sizeof(log), "%s/vice.log", j->dir);
+
+   char* argv[] = {
+      exe, (char*) "-sounddev", (char*) "dummy", (char*) standard,
+      (char*) "-VICIImodel", (char*) model, prg, NULL
+   };
+   j->vice = spawn(j->dir, argv, log, j->dir + 5);
+   j->viceStarted = now();
+}
+
+// Returns 1 if the test couldn't be started
+static int startJob(struct job* j, struct test* t) {
+   memset(j, 0, sizeof(*j));
+   strcpy(j->dir, "/tmp/vicii_test_XXXXXX");
+   if (mkdtemp(j->dir) == NULL) {
+      t->status = ST_FAIL;
+      strcpy(t->reason, "mkdtemp failed");
+      return 1;
+   }
+   j->t = t;
+   linkTables(j->dir);
+
+   t->status = ST_RUNNING;
+   t->start = now();
+   if (mode == MODE_VICE)
+      startVice(j);
+   else
+      startSim(j);
+   return 0;
+}
+
+static void moveFile(const char* dir, const char* name, struct test* t,
+                     const char* prefix, const char* ext) {
+   char from[1024], to[1024];
+   snprintf(from, sizeof(from), "%s/%s", dir, name);
+   outputName(to, sizeof(to), t, prefix, ext);
+   if (rename(from, to) != 0 && errno == EXDEV) {
+      // /tmp is often another file system
+      char cmd[2200];
+      snprintf(cmd, sizeof(cmd), "mv -f '%s' '%s'", from, to);
+      if (system(cmd) != 0)
+         perror(to);
+   }
+}
+
+static void finishJob(struct job* j) {
+   struct test* t = j->t;
+   t->seconds = now() - t->start;
+
+   if (t->status == ST_RUNNING) {
+      char ppm[1024], png[1024];
+      struct image img;
+      snprintf(ppm, sizeof(ppm), "%s/capture.ppm", j->dir);
+      bool haveFrame = image_load(ppm, &img) == 0;
+      int exitStatus = WIFEXITED(j->simStatus) ? WEXITSTATUS(j->simStatus)
+                                               : -1;
+      if (exitStatus == 1 && goldenFile && mode == MODE_STANDALONE) {
+         t->status = ST_FAIL;
+         strcpy(t->reason, "differs from golden manifest");
+      } else if (exitStatus != 0) {
+         t->status = ST_FAIL;
+         snprintf(t->reason, sizeof(t->reason), "simulator exit status %d",
+                  exitStatus);
+      } else if (!haveFrame && !goldenFile) {
+         t->status = ST_FAIL;
+         strcpy(t->reason, "no frame written");
+      } else {
+         // With a golden manifest we only get frames that changed
+         t->status = ST_PASS;
+      }
+      if (haveFrame) {
+         image_scale(&img, t->width, t->height);
+         outputName(png, sizeof(png), t, "fpga_", ".png");
+         t->hasImage = image_save_png(png, &img) == 0;
+         image_free(&img);
+      }
+   }
+
+   if (hashOut) {
+      char name[1024], line[8192];
+      snprintf(name, sizeof(name), "%s/hashes.txt", j->dir);
+      FILE* fp = fopen(name, "r");
+      if (fp) {
+         size_t n;
+         while ((n = fread(line, 1, sizeof(line), fp)) > 0)
+            fwrite(line, 1, n, hashOut);
+         fclose(fp);
+      }
+   }
+
+   moveFile(j->dir, "sim.log", t, "fpga_", ".log");
+   if (mode == MODE_VICE) {
+      moveFile(j->dir, "vice.log", t, "vice_", ".log");
+      moveFile(j->dir, "screenshot.png", t, "vice_", ".png");
+   }
+
+   char cmd[128];
+   snprintf(cmd, sizeof(cmd), "rm -rf '%s'", j->dir);
+   if (system(cmd) != 0)
+      perror(j->dir);
+   j->t = NULL;
+}
+
+static void killJob(struct job* j) {
+   if (j->sim > 0)
+      kill(j->sim, SIGKILL);
+   if (j->vice > 0)
+      kill(j->vice, SIGKILL);
+}
+
+// Advance a running job. Returns 1 once it is finished.
+static int pollJob(struct job* j) {
+   struct test* t = j->t;
+   double tnow = now();
+   int status;
+
+   if (mode == MODE_VICE && j->sim == 0 &&
+          tnow - j->viceStarted >= t->warmup)
+      startSim(j);
+
+   if (j->sim > 0 && waitpid(j->sim, &status, WNOHANG) == j->sim) {
+      j->simStatus = status;
+      j->sim = -1;
+      j->simDone = tnow;
+   }
+   if (j->vice > 0 && waitpid(j->vice, &status, WNOHANG) == j->vice) {
+      j->vice = -1;
+      if (j->sim == 0) {
+         t->status = ST_FAIL;
+         strcpy(t->reason, "VICE exited before capture");
+         return 1;
+      }
+   }
+
+   // Give VICE a moment to write its own screenshot
+   if (j->sim < 0 && j->vice > 0 && tnow - j->simDone > 2) {
+      kill(j->vice, SIGTERM);
+      waitpid(j->vice, &status, 0);
+      j->vice = -1;
+   }
+
+   if (j->sim < 0 && j->vice <= 0)
+      return 1;
+
+   if (tnow - t->start > timeoutSecs) {
+      killJob(j);
+      if (j->sim > 0)
+         waitpid(j->sim, &status, 0);
+      if (j->vice > 0)
+         waitpid(j->vice, &status, 0);
+      t->status = ST_TIMEOUT;
+      strcpy(t->reason, "timed out");
+      return 1;
+   }
+   return 0;
+}
+
+static void jsonString(FILE* fp, const char* s) {
+   fputc('"', fp);
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+         fputc('\\', fp);
+      fputc(*s, fp);
+   }
+   fputc('"', fp);
+}
+
+static int writeSummary(double seconds) {
+   FILE* fp = fopen(summaryFile, "w");
+   if (fp == NULL) {
+      perror(summaryFile);
+      return 1;
+   }
+
+   int count[ST_TIMEOUT + 1] = { 0 };
+   for (int i = 0; i < numTests; i++)
+      count[tests[i].status]++;
+
+   fprintf(fp, "{\n");
+   fprintf(fp, "  \"mode\": \"%s\",\n",
+           mode == MODE_VICE ? "vice" : "standalone");
+   fprintf(fp, "  \"shard\": \"%d/%d\",\n", shardIndex, shardCount);
+   fprintf(fp, "  \"workers\": %d,\n", numWorkers);
+   fprintf(fp, "  \"seconds\": %.1f,\n", seconds);
+   fprintf(fp, "  \"total\": %d,\n", numTests);
+   fprintf(fp, "  \"passed\": %d,\n", count[ST_PASS]);
+   fprintf(fp, "  \"failed\": %d,\n", count[ST_FAIL]);
+   fprintf(fp, "  \"timeouts\": %d,\n", count[ST_TIMEOUT]);
+   fprintf(fp, "  \"tests\": [\n");
+   for (int i = 0; i < numTests; i++) {
+      struct test* t = &tests[i];
+      char png[512];
+      outputName(png, sizeof(png), t, "fpga_", ".png");
+      fprintf(fp, "    { \"name\": ");
+      jsonString(fp, t->path);
+      fprintf(fp, ", \"standard\": ");
+      jsonString(fp, t->standard);
+      fprintf(fp, ", \"status\": \"%s\", \"seconds\": %.1f",
+              statusName[t->status], t->seconds);
+      if (mode == MODE_STANDALONE)
+         fprintf(fp, ", \"frames\": %d", t->frames);
+      if (t->hasImage) {
+         fprintf(fp, ", \"image\": ");
+         jsonString(fp, png);
+      }
+      if (t->reason[0]) {
+         fprintf(fp, ", \"reason\": ");
+         jsonString(fp, t->reason);
+      }
+      fprintf(fp, " }%s\n", i + 1 < numTests ? "," : "");
+   }
+   fprintf(fp, "  ]\n}\n");
+   fclose(fp);
+   return 0;
+}
+
+static void usage() {
+   printf("Usage: run_tests [options] [filter ...]\n");
+   printf("  -j <n>    : tests to run at once (default one per cpu)\n");
+   printf("  -v <dir>  : shadow VICE in dir (i.e. vicii-vice-3.4) instead\n");
+   printf("              of running standalone\n");
+   printf("  -K <dir>  : basic, kernal and chargen roms (standalone)\n");
+   printf("  -s <sim>  : simulator (default %s)\n", simPath);
+   printf("  -H <dir>  : where the simulator's .bin tables are (default %s)\n", hdlDir);
+   printf("  -l <file> : test list (default %s)\n", listFile);
+   printf("  -o <file> : JSON summary (default %s)\n", summaryFile);
+   printf("  -m <file> : frame hashes of all tests (default %s)\n", hashFile);
+   printf("  -g <file> : golden manifest (a -m file from a good run), only\n");
+   printf("              frames that differ from it are written\n");
+   printf("  -t <secs> : per test timeout (default %d)\n", timeoutSecs);
+   printf("  -S <k/n>  : only run shard k of n\n");
+   printf("Only tests whose path contains one of the filters are run.\n");
+}
+
+int main(int argc, char** argv) {
+   int c;
+   while ((c = getopt(argc, argv, "hj:v:K:s:H:l:o:m:g:t:S:")) != -1) {
+      switch (c) {
+         case 'j': numWorkers = atoi(optarg); break;
+         case 'v': viceDir = optarg; mode = MODE_VICE; break;
+         case 'K': romDir = optarg; break;
+         case 's': simPath = optarg; break;
+         case 'H': hdlDir = optarg; break;
+         case 'l': listFile = optarg; break;
+         case 'o': summaryFile = optarg; break;
+         case 'm': hashFile = optarg; break;
+         case 'g': goldenFile = optarg; break;
+         case 't': timeoutSecs = atoi(optarg); break;
+         case 'S':
+            if (sscanf(optarg, "%d/%d", &shardIndex, &shardCount) != 2 ||
+                   shardCount < 1 || shardIndex < 0 ||
+                   shardIndex >= shardCount) {
+               fprintf(stderr, "bad shard %s\n", optarg);
+               return 1;
+            }
+            break;
+         case 'h':
+            usage();
+            return 0;
+         default:
+            usage();
+            return 1;
+      }
+   }
+
+   if (numWorkers <= 0)
+      numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+   if (numWorkers <= 0)
+      numWorkers = 1;
+
+   // Children run elsewhere so everything handed to them is absolute
+   static char simAbs[1024], romAbs[1024], viceAbs[1024], goldenAbs[1024];
+   if (getcwd(testsDir, sizeof(testsDir)) == NULL ||
+          realpath(simPath, simAbs) == NULL) {
+      fprintf(stderr, "can't find simulator %s\n", simPath);
+      return 1;
+   }
+   simPath = simAbs;
+   if (romDir && realpath(romDir, romAbs))
+      romDir = romAbs;
+   if (viceDir && realpath(viceDir, viceAbs))
+      viceDir = viceAbs;
+   if (goldenFile) {
+      if (realpath(goldenFile, goldenAbs) == NULL) {
+         fprintf(stderr, "can't find golden manifest %s\n", goldenFile);
+         return 1;
+      }
+      goldenFile = goldenAbs;
+   }
+   if (mode == MODE_STANDALONE) {
+      hashOut = fopen(hashFile, "w");
+      if (hashOut == NULL) {
+         perror(hashFile);
+         return 1;
+      }
+   }
+
+   if (loadTests(argv + optind, argc - optind))
+      return 1;
+
+   struct job* jobs = (struct job*) calloc(numWorkers, sizeof(struct job));
+   double start = now();
+   int next = 0, done = 0;
+
+   while (done < numTests) {
+      for (int w = 0; w < numWorkers; w++) {
+         struct job* j = &jobs[w];
+         struct test* t = j->t;
+         if (t == NULL && next < numTests) {
+            t = &tests[next++];
+            if (startJob(j, t) == 0)
+               t = NULL;
+         } else if (t && pollJob(j)) {
+            finishJob(j);
+         } else {
+            t = NULL;
+         }
+
+         if (t) {
+            done++;
+            printf("[%d/%d] %-50s %-7s %6.1fs %s\n", done, numTests,
+                   t->path, statusName[t->status], t->seconds, t->reason);
+            fflush(stdout);
+         }
+      }
+
+      struct timespec ts = { 0, 20 * 1000000 };
+      nanosleep(&ts, NULL);
+   }
+
+   double seconds = now() - start;
+   writeSummary(seconds);
+   if (hashOut)
+      fclose(hashOut);
+
+   int failed = 0;
+   for (int i = 0; i < numTests; i++)
+      if (tests[i].status != ST_PASS)
+         failed++;
+   printf("%d tests, %d failed, %.1f seconds\n", numTests, failed, seconds);
+   return failed ? 1 : 0;
+}
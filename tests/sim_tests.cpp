@@ -0,0 +1,642 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+// 
+// This program is free software: you can redistribute it and/or modify  
+// it under the terms of the GNU General Public License as published by  
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but 
+// WITHOUT ANY WARRANTY; without even the implied warranty of 
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License 
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Checks for the parts of the simulator that don't need the model: the
+// built in 6510, the C64 around it and the VICE snapshot loader.
+//
+//    make sim_tests && ./sim_tests
+//
+// Prints each failed check and exits non zero if there were any.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "c64.h"
+#include "constants.h"
+#include "cpu6510.h"
+#include "framehash.h"
+#include "log.h"
+#include "statelog.h"
+#include "vsf.h"
+
+static int failures;
+static int checks;
+
+#define CHECK(cond, ...) do { \
+   checks++; \
+   if (!(cond)) { \
+      failures++; \
+      printf ("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf (__VA_ARGS__); \
+      printf ("\n"); \
+   } \
+} while (0)
+
+// Where test code goes and where the IRQ/NMI vectors point
+#define ORG     0x1000
+#define IRQ_ORG 0x2000
+#define NMI_ORG 0x3000
+
+static unsigned char mem[65536];
+static struct cpu6510 cpu;
+
+// Carry out the pending bus access and finish the cycle
+static void cycle() {
+   if (cpu.rw)
+      cpu.data = mem[cpu.addr];
+   else
+      mem[cpu.addr] = cpu.data;
+   cpu_tick(&cpu);
+}
+
+// Run one instruction from its opcode fetch up to the next opcode
+// fetch. Returns the number of cycles it took.
+static int step() {
+   int n = 0;
+   do {
+      cycle();
+      n++;
+   } while (cpu.step != 0 && n < 100);
+   return n;
+}
+
+// Fresh memory and CPU with code at ORG
+static void load(const unsigned char* code, int len) {
+   memset(mem, 0xea, sizeof(mem));
+   memcpy(&mem[ORG], code, len);
+   mem[0xfffe] = IRQ_ORG & 0xff;
+   mem[0xffff] = IRQ_ORG >> 8;
+   mem[0xfffa] = NMI_ORG & 0xff;
+   mem[0xfffb] = NMI_ORG >> 8;
+   cpu_init(&cpu, ORG);
+}
+
+struct timing {
+   const char* what;
+   unsigned char code[3];
+   unsigned char x;
+   unsigned char y;
+   int cycles;
+};
+
+// Operands point at $10xx/$20xx with $80/$81 holding a pointer to
+// $20f0 so the indexed forms can be made to cross a page with x or y.
+static const struct timing timings[] = {
+   { "nop",              { 0xea },             0,    0,    2 },
+   { "lda #",            { 0xa9, 0x01 },       0,    0,    2 },
+   { "lda zp",           { 0xa5, 0x80 },       0,    0,    3 },
+   { "lda zp,x",         { 0xb5, 0x80 },       1,    0,    4 },
+   { "ldx zp,y",         { 0xb6, 0x80 },       0,    1,    4 },
+   { "lda abs",          { 0xad, 0x00, 0x20 }, 0,    0,    4 },
+   { "lda abs,x",        { 0xbd, 0x00, 0x20 }, 0x10, 0,    4 },
+   { "lda abs,x cross",  { 0xbd, 0xf0, 0x20 }, 0x20, 0,    5 },
+   { "lda abs,y",        { 0xb9, 0x00, 0x20 }, 0,    0x10, 4 },
+   { "lda abs,y cross",  { 0xb9, 0xf0, 0x20 }, 0,    0x20, 5 },
+   { "lda (zp,x)",       { 0xa1, 0x7e },       2,    0,    6 },
+   { "lda (zp),y",       { 0xb1, 0x80 },       0,    0x01, 5 },
+   { "lda (zp),y cross", { 0xb1, 0x80 },       0,    0x20, 6 },
+   { "sta zp",           { 0x85, 0x80 },       0,    0,    3 },
+   { "sta abs",          { 0x8d, 0x00, 0x20 }, 0,    0,    4 },
+   { "sta abs,x",        { 0x9d, 0x00, 0x20 }, 0x10, 0,    5 },
+   { "sta (zp),y",       { 0x91, 0x80 },       0,    0x01, 6 },
+   { "asl a",            { 0x0a },             0,    0,    2 },
+   { "inc zp",           { 0xe6, 0x90 },       0,    0,    5 },
+   { "inc zp,x",         { 0xf6, 0x90 },       1,    0,    6 },
+   { "inc abs",          { 0xee, 0x00, 0x20 }, 0,    0,    6 },
+   { "inc abs,x",        { 0xfe, 0x00, 0x20 }, 0x10, 0,    7 },
+   { "slo (zp),y",       { 0x13, 0x80 },       0,    0x01, 8 },
+   { "pha",              { 0x48 },             0,    0,    3 },
+   { "pla",              { 0x68 },             0,    0,    4 },
+   { "jmp abs",          { 0x4c, 0x00, 0x20 }, 0,    0,    3 },
+   { "jmp (ind)",        { 0x6c, 0x80, 0x00 }, 0,    0,    5 },
+   { "jsr",              { 0x20, 0x00, 0x20 }, 0,    0,    6 },
+   { "rts",              { 0x60 },             0,    0,    6 },
+   { "rti",              { 0x40 },             0,    0,    6 },
+   { "brk",              { 0x00 },             0,    0,    7 },
+};
+
+static void test_timing() {
+   for (unsigned int i = 0; i < sizeof(timings) / sizeof(timings[0]); i++) {
+      const struct timing* t = &timings[i];
+      load(t->code, sizeof(t->code));
+      mem[0x80] = 0xf0;
+      mem[0x81] = 0x20;
+      cpu.x = t->x;
+      cpu.y = t->y;
+      int n = step();
+      CHECK(n == t->cycles, "%s took %d cycles, expected %d",
+            t->what, n, t->cycles);
+   }
+}
+
+// Branches: 2 not taken, 3 taken, 4 taken into another page
+static void test_branches() {
+   static const unsigned char beq[] = { 0xf0, 0x10 };
+   load(beq, sizeof(beq));
+   int n = step();
+   CHECK(n == 2 && cpu.pc == ORG + 2, "beq not taken: %d cycles pc=%04x",
+         n, cpu.pc);
+
+   load(beq, sizeof(beq));
+   cpu.p |= CPU_FLAG_Z;
+   n = step();
+   CHECK(n == 3 && cpu.pc == ORG + 0x12, "beq taken: %d cycles pc=%04x",
+         n, cpu.pc);
+
+   // Backwards out of the page
+   static const unsigned char bne[] = { 0xd0, 0xf0 };
+   load(bne, sizeof(bne));
+   n = step();
+   CHECK(n == 4 && cpu.pc == ORG - 0x0e, "bne across page: %d cycles pc=%04x",
+         n, cpu.pc);
+
+   // Forwards out of the page from the end of one
+   memset(mem, 0xea, sizeof(mem));
+   mem[0x10fd] = 0x10; // bpl +2
+   mem[0x10fe] = 0x02;
+   cpu_init(&cpu, 0x10fd);
+   n = step();
+   CHECK(n == 4 && cpu.pc == 0x1101, "bpl across page: %d cycles pc=%04x",
+         n, cpu.pc);
+}
+
+struct bcd {
+   const char* what;
+   unsigned char op;     // 0x69 adc #, 0xe9 sbc #
+   unsigned char a;
+   unsigned char v;
+   int carry;
+   unsigned char result;
+   unsigned char flags;  // N V Z C as they should come out
+};
+
+// NMOS decimal mode results. N, V and Z don't follow the BCD result
+// for ADC; for SBC all flags come from the binary subtraction.
+static const struct bcd bcds[] = {
+   { "09+01",    0x69, 0x09, 0x01, 0, 0x10, 0 },
+   { "58+46",    0x69, 0x58, 0x46, 0, 0x04, CPU_FLAG_N | CPU_FLAG_V | CPU_FLAG_C },
+   { "12+34+c",  0x69, 0x12, 0x34, 1, 0x47, 0 },
+   { "99+01",    0x69, 0x99, 0x01, 0, 0x00, CPU_FLAG_N | CPU_FLAG_C },
+   { "79+10",    0x69, 0x79, 0x10, 0, 0x89, CPU_FLAG_N | CPU_FLAG_V },
+   { "80+80",    0x69, 0x80, 0x80, 0, 0x60, CPU_FLAG_V | CPU_FLAG_C | CPU_FLAG_Z },
+   { "46-12",    0xe9, 0x46, 0x12, 1, 0x34, CPU_FLAG_C },
+   { "40-13",    0xe9, 0x40, 0x13, 1, 0x27, CPU_FLAG_C },
+   { "32-02-b",  0xe9, 0x32, 0x02, 0, 0x29, CPU_FLAG_C },
+   { "00-01",    0xe9, 0x00, 0x01, 1, 0x99, CPU_FLAG_N },
+   { "21-34",    0xe9, 0x21, 0x34, 1, 0x87, CPU_FLAG_N },
+   { "80-01",    0xe9, 0x80, 0x01, 1, 0x79, CPU_FLAG_V | CPU_FLAG_C },
+};
+
+static void test_decimal() {
+   const unsigned char nvzc = CPU_FLAG_N | CPU_FLAG_V | CPU_FLAG_Z | CPU_FLAG_C;
+   for (unsigned int i = 0; i < sizeof(bcds) / sizeof(bcds[0]); i++) {
+      const struct bcd* t = &bcds[i];
+      unsigned char code[] = { t->op, t->v };
+      load(code, sizeof(code));
+      cpu.a = t->a;
+      cpu.p |= CPU_FLAG_D | (t->carry ? CPU_FLAG_C : 0);
+      step();
+      CHECK(cpu.a == t->result && (cpu.p & nvzc) == t->flags,
+            "%s: a=%02x flags=%02x, expected a=%02x flags=%02x",
+            t->what, cpu.a, cpu.p & nvzc, t->result, t->flags);
+   }
+}
+
+// Step until an interrupt sequence lands on vector (IRQ_ORG or
+// NMI_ORG). Returns how many instructions, or what was left of one,
+// ran before it. -1 if there was no interrupt within max.
+static int until_interrupt(unsigned short vector, int max) {
+   for (int i = 0; i <= max; i++) {
+      step();
+      if (cpu.pc == vector)
+         return i;
+   }
+   return -1;
+}
+
+static void test_interrupts() {
+   // IRQ held from the start, masked until cli. The instruction after
+   // cli still runs because the poll happened while I was set.
+   static const unsigned char cli[] = { 0x58, 0xea, 0xea, 0xea };
+   load(cli, sizeof(cli));
+   cpu.irq = 1;
+   int n = until_interrupt(IRQ_ORG, 8);
+   CHECK(n == 2, "irq after cli: %d instructions ran, expected 2", n);
+   CHECK(mem[0x01fd] == (ORG + 2) >> 8 && mem[0x01fc] == ((ORG + 2) & 0xff),
+         "irq after cli pushed %02x%02x", mem[0x01fd], mem[0x01fc]);
+   CHECK((mem[0x01fb] & CPU_FLAG_B) == 0, "irq pushed B set");
+   CHECK(cpu.p & CPU_FLAG_I, "irq left I clear");
+
+   // Asserted before the last cycle of a nop it's too late for that
+   // nop, one cycle earlier it's not.
+   static const unsigned char nops[] = { 0xea, 0xea, 0xea };
+   load(nops, sizeof(nops));
+   cpu.p &= ~CPU_FLAG_I;
+   cycle();
+   cpu.irq = 1;
+   n = until_interrupt(IRQ_ORG, 8);
+   CHECK(n == 2, "irq on last cycle: %d instructions ran, expected 2", n);
+
+   load(nops, sizeof(nops));
+   cpu.p &= ~CPU_FLAG_I;
+   cpu.irq = 1;
+   n = until_interrupt(IRQ_ORG, 8);
+   CHECK(n == 1, "irq on first cycle: %d instructions ran, expected 1", n);
+
+   // A taken branch that stays in its page doesn't poll, so the
+   // interrupt waits for the instruction after it
+   static const unsigned char bra[] = { 0x18, 0x90, 0x00, 0xea, 0xea };
+   load(bra, sizeof(bra));
+   cpu.p &= ~CPU_FLAG_I;
+   step();
+   cpu.irq = 1;
+   n = until_interrupt(IRQ_ORG, 8);
+   CHECK(n == 2, "irq during branch: %d instructions ran, expected 2", n);
+
+   // Not taken, it polls like anything else
+   static const unsigned char nbra[] = { 0x38, 0x90, 0x00, 0xea, 0xea };
+   load(nbra, sizeof(nbra));
+   cpu.p &= ~CPU_FLAG_I;
+   step();
+   cpu.irq = 1;
+   n = until_interrupt(IRQ_ORG, 8);
+   CHECK(n == 1, "irq during untaken branch: %d instructions ran, expected 1",
+         n);
+
+   // NMI is an edge and ignores I. Dropping it again doesn't cancel it.
+   load(nops, sizeof(nops));
+   cpu.nmi = 1;
+   cycle();
+   cpu.nmi = 0;
+   n = until_interrupt(NMI_ORG, 8);
+   CHECK(n == 1, "nmi: %d instructions ran, expected 1", n);
+
+   // Held high it's still only one
+   load(nops, sizeof(nops));
+   cpu.nmi = 1;
+   n = until_interrupt(NMI_ORG, 8);
+   CHECK(n == 1, "nmi held: %d instructions ran, expected 1", n);
+   n = until_interrupt(NMI_ORG, 8);
+   CHECK(n == -1, "nmi taken twice for one edge");
+}
+
+static void test_vic_fetch() {
+   struct c64* m = c64_init(NULL, 0);
+
+   for (int i = 0; i < 65536; i++)
+      m->ram[i] = (i >> 8) ^ i;
+   for (int i = 0; i < 4096; i++)
+      m->chargen[i] = ~i;
+   m->haveChargen = 1;
+   m->color[0x123] = 0x0a;
+
+   for (int bank = 0; bank < 4; bank++) {
+      // CIA 2 port A bits 0-1 select the bank, inverted
+      m->cia2.ddra = 0x3f;
+      m->cia2.pra = (m->cia2.pra & ~3) | (3 - bank);
+      unsigned short base = bank << 14;
+
+      unsigned short got = c64_vic_fetch(m, 0x0123);
+      CHECK((got & 0xff) == m->ram[base + 0x123],
+            "bank %d: $0123 read %02x, expected ram %02x",
+            bank, got & 0xff, m->ram[base + 0x123]);
+      CHECK((got >> 8) == 0x0a, "bank %d: color %x, expected a",
+            bank, got >> 8);
+
+      // Char ROM at $1000-$1fff in banks 0 and 2 only
+      got = c64_vic_fetch(m, 0x1234) & 0xff;
+      unsigned char want = (bank & 1) ? m->ram[base + 0x1234] :
+                                        m->chargen[0x234];
+      CHECK(got == want, "bank %d: $1234 read %02x, expected %02x",
+            bank, got, want);
+
+      got = c64_vic_fetch(m, 0x2234) & 0xff;
+      CHECK(got == m->ram[base + 0x2234],
+            "bank %d: $2234 read %02x, expected ram %02x",
+            bank, got, m->ram[base + 0x2234]);
+
+      // Only 14 address lines
+      got = c64_vic_fetch(m, 0xc123) & 0xff;
+      CHECK(got == m->ram[base + 0x123], "bank %d: high bits not ignored",
+            bank);
+   }
+
+   // Port bits set to input read as 1, that's bank 0
+   m->cia2.ddra = 0x3c;
+   m->cia2.pra = 0x00;
+   CHECK((c64_vic_fetch(m, 0x0040) & 0xff) == m->ram[0x0040],
+         "inputs didn't select bank 0");
+
+   // Without the ROM it's just RAM
+   m->haveChargen = 0;
+   CHECK((c64_vic_fetch(m, 0x1234) & 0xff) == m->ram[0x1234],
+         "no chargen but $1234 didn't read ram");
+
+   c64_free(m);
+}
+
+// A -L record must print the same row -l 4 printed before the binary
+// log, which formatted the model's signals directly.
+static void test_statelog() {
+   static const char* want =
+      "* 1   07  1f8  12  1   0   5   1   0   1  S   1   0  503 048 047 "
+      "3fff 1234  5a  a5  1  0 ef  1000000000000001 "
+      "11110000111100000000000000001111   1 021 018 3 0c12 1";
+   struct state_rec r;
+   char buf[256];
+
+   memset(&r, 0, sizeof(r));
+   r.flags = SR_DOT_RISE | SR_D4X | SR_DOTR | SR_IRQ | SR_AEC | SR_RAS |
+             SR_RW | SR_BADLINE | SR_BMM;
+   r.cnt = 7;
+   r.xpos = 0x1f8;
+   r.cycleNum = 12;
+   r.cycleBit = 5;
+   r.cycleType = VIC_HS1;
+   r.rasterX = 503;
+   r.rasterLine = 48;
+   r.rasterLineD = 47;
+   r.adi = 0x3fff;
+   r.ado = 0x1234;
+   r.dbi = 0x5a;
+   r.dbo = 0xa5;
+   r.refc = 0xef;
+   r.pps = 0x8001;
+   r.phir = 0xf0f0000f;
+   r.spriteMc = 21;
+   r.spriteMcBase = 18;
+   r.rc = 3;
+   r.vicAddr = 0x0c12;
+
+   statelog_format(&r, buf);
+   CHECK(strcmp(buf, want) == 0, "state row\n  got  '%s'\n  want '%s'",
+         buf, want);
+}
+
+// The reference XXH64 values (seed 0)
+static void test_xxh64() {
+   static const struct {
+      const char* text;
+      uint64_t hash;
+   } vectors[] = {
+      { "", 0xef46db3751d8e999ULL },
+      { "a", 0xd24ec4f1a98c6e5bULL },
+      { "abc", 0x44bc2cf5ad770999ULL },
+      { "Nobody inspects the spammish repetition", 0xfbcea83c8a378bf1ULL },
+   };
+   for (unsigned i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+      uint64_t h = xxh64(vectors[i].text, strlen(vectors[i].text), 0);
+      CHECK(h == vectors[i].hash, "xxh64(\"%s\") = %016llx, expected %016llx",
+            vectors[i].text, (unsigned long long) h,
+            (unsigned long long) vectors[i].hash);
+   }
+}
+
+// Frames written with fh_write come back from fh_load_manifest and
+// compare as the run that wrote them would see them
+static void test_manifest() {
+   char path[] = "/tmp/sim_testsXXXXXX";
+   struct frame_buffer* fb = fb_init(16, 8);
+   struct frame_hash f0 = {}, f1 = {}, now = {};
+
+   for (int y = 0; y < 8; y++)
+      for (int x = 0; x < 16; x++)
+         fb_put(fb, x, y, 0xff000000u | (y << 8) | x);
+   fh_compute(fb, &f0);
+   fb_put(fb, 3, 2, 0xffffffffu);
+   fh_compute(fb, &f1);
+   CHECK(f0.frame != f1.frame, "one pixel didn't change the frame hash");
+
+   int fd = mkstemp(path);
+   FILE* fp = fd < 0 ? NULL : fdopen(fd, "w");
+   CHECK(fp != NULL, "can't create %s", path);
+   if (!fp) {
+      fb_free(fb);
+      return;
+   }
+   // Frame 1 is missing and records for other runs are ignored
+   fprintf(fp, "# test chip config frame hash lines\n");
+   fh_write(fp, "t", 1, 0, 0, &f0);
+   fh_write(fp, "t", 1, 0, 2, &f1);
+   fh_write(fp, "t", 0, 0, 3, &f0);
+   fh_write(fp, "t", 1, 5, 3, &f0);
+   fh_write(fp, "other", 1, 0, 3, &f0);
+   fclose(fp);
+
+   struct hash_manifest* m = fh_load_manifest(path, "t", 1, 0);
+   unlink(path);
+   CHECK(m != NULL, "manifest didn't load");
+   if (!m) {
+      fb_free(fb);
+      return;
+   }
+   CHECK(m->numFrames == 3, "manifest has %d frames, expected 3",
+         m->numFrames);
+   if (m->numFrames == 3) {
+      CHECK(m->frames[0].frame == f0.frame && m->frames[2].frame == f1.frame,
+            "frame hashes didn't round trip");
+      CHECK(m->frames[2].numLines == 8 &&
+            memcmp(m->frames[2].lines, f1.lines, 8 * sizeof(uint64_t)) == 0,
+            "line hashes didn't round trip");
+   }
+
+   // Same frame, a frame that differs from line 2 and missing frames
+   fh_compute(fb, &now);
+   CHECK(fh_compare(m, 2, &now) == -1, "matching frame didn't match");
+   int line = fh_compare(m, 0, &now);
+   CHECK(line == 2, "differing frame gave %d, expected line 2", line);
+   CHECK(fh_compare(m, 1, &now) == -2, "frame 1 should be missing");
+   CHECK(fh_compare(m, 3, &now) == -2, "frame 3 should be missing");
+
+   fh_free_manifest(m);
+   free(f0.lines);
+   free(f1.lines);
+   free(now.lines);
+   fb_free(fb);
+}
+
+// Just enough of a .vsf for vsf_load in a new file named by the mkstemp
+// template path, with the VIC on raster line line. Only the first
+// modules modules are written (the VIC is last). Returns NULL if the
+// file can't be written.
+#define VSF_VIC_LEN   (0x6f5 + 8 * 12)
+#define VSF_MEM_LEN   (4 + 65536)
+#define VSF_CPU_LEN   11
+#define VSF_CIA_LEN   21
+
+static void put_dword(unsigned char* p, unsigned int v) {
+   p[0] = v;
+   p[1] = v >> 8;
+   p[2] = v >> 16;
+   p[3] = v >> 24;
+}
+
+static void put_module(FILE* fp, const char* name, const unsigned char* data,
+                       unsigned int len) {
+   unsigned char hdr[22];
+   memset(hdr, 0, sizeof(hdr));
+   strncpy((char*) hdr, name, 16);
+   hdr[16] = 1;
+   hdr[17] = 1;
+   put_dword(hdr + 18, len + sizeof(hdr));
+   fwrite(hdr, 1, sizeof(hdr), fp);
+   fwrite(data, 1, len, fp);
+}
+
+static const char* write_vsf(char* path, unsigned int line, int modules) {
+   static unsigned char vic[VSF_VIC_LEN], mem[VSF_MEM_LEN];
+   static unsigned char cpu6510[VSF_CPU_LEN], cia1[VSF_CIA_LEN];
+   static unsigned char cia2[VSF_CIA_LEN];
+
+   memset(vic, 0, sizeof(vic));
+   vic[0x001 + 0x11] = 0x1b;
+   vic[0x001 + 0x20] = 0x0e;
+   put_dword(vic + 0x041, 5);
+   put_dword(vic + 0x049, line);
+   for (int i = 0; i < 1024; i++)
+      vic[0x2f5 + i] = 0xf0 | (i & 0x0f);
+   // Only sprite 3 is part way through (mcbase 63 is done)
+   for (int n = 0; n < 8; n++)
+      vic[0x6f5 + n * 12 + 5] = 63;
+   vic[0x6f5 + 3 * 12 + 4] = 21;  // mc
+   vic[0x6f5 + 3 * 12 + 5] = 18;  // mcbase
+
+   mem[0] = 0x37;
+   mem[1] = 0x2f;
+   for (int i = 0; i < 65536; i++)
+      mem[4 + i] = i * 7;
+
+   memset(cpu6510, 0, sizeof(cpu6510));
+   cpu6510[4] = 0x11;  // a
+   cpu6510[5] = 0x22;  // x
+   cpu6510[6] = 0x33;  // y
+   cpu6510[7] = 0xf0;  // sp
+   cpu6510[8] = 0x34;  // pc
+   cpu6510[9] = 0x12;
+   cpu6510[10] = CPU_FLAG_C;
+
+   memset(cia1, 0, sizeof(cia1));
+   memset(cia2, 0, sizeof(cia2));
+   cia2[0] = 0x01;  // bank 2
+   cia2[2] = 0x3f;
+
+   int fd = mkstemp(path);
+   FILE* fp = fd < 0 ? NULL : fdopen(fd, "wb");
+   if (!fp)
+      return NULL;
+
+   unsigned char hdr[58];
+   memset(hdr, 0, sizeof(hdr));
+   memcpy(hdr, "VICE Snapshot File\032", 19);
+   memcpy(hdr + 21, "C64SC", 5);
+   fwrite(hdr, 1, sizeof(hdr), fp);
+
+   struct { const char* name; unsigned char* data; unsigned int len; } mods[] = {
+      { "MAINCPU", cpu6510, sizeof(cpu6510) },
+      { "C64MEM", mem, sizeof(mem) },
+      { "CIA1", cia1, sizeof(cia1) },
+      { "CIA2", cia2, sizeof(cia2) },
+      { "VIC-II", vic, sizeof(vic) },
+   };
+   for (int i = 0; i < modules && i < 5; i++)
+      put_module(fp, mods[i].name, mods[i].data, mods[i].len);
+   fclose(fp);
+   return path;
+}
+
+static void test_vsf() {
+   char path[] = "/tmp/sim_testsXXXXXX";
+   struct vicii_state state;
+   struct c64* m = c64_init(NULL, 0);
+
+   if (!write_vsf(path, 0x10, 5)) {
+      CHECK(0, "can't write %s", path);
+      return;
+   }
+   int err = vsf_load(path, &state, m);
+   unlink(path);
+   CHECK(err == 0, "snapshot on line $10 didn't load");
+   if (err == 0) {
+      CHECK(state.raster_line == 0x10 && state.cycle_num == 5,
+            "line %d cycle %d", state.raster_line, state.cycle_num);
+      CHECK(state.vice_reg[0x11] == 0x1b && state.vice_reg[0x20] == 0x0e,
+            "registers $11=%02x $20=%02x", state.vice_reg[0x11],
+            state.vice_reg[0x20]);
+      CHECK(state.idle && state.vborder && state.main_border,
+            "idle %d vborder %d main_border %d", state.idle, state.vborder,
+            state.main_border);
+      CHECK(state.mc[3] == 21 && state.mcbase[3] == 18 &&
+            state.sprite_dma[3] && !state.sprite_dma[0],
+            "sprite 3 mc %d mcbase %d dma %d", state.mc[3], state.mcbase[3],
+            state.sprite_dma[3]);
+      CHECK(m->color[0x3f7] == 0x07, "color ram not masked: %02x",
+            m->color[0x3f7]);
+      CHECK(m->ram[0x1234] == (unsigned char) (0x1234 * 7), "ram not loaded");
+      CHECK(m->cpu.pc == 0x1234 && m->cpu.a == 0x11 && m->cpu.x == 0x22 &&
+            m->cpu.y == 0x33 && m->cpu.s == 0xf0 && (m->cpu.p & CPU_FLAG_C),
+            "cpu pc=%04x a=%02x x=%02x y=%02x s=%02x p=%02x", m->cpu.pc,
+            m->cpu.a, m->cpu.x, m->cpu.y, m->cpu.s, m->cpu.p);
+      CHECK((c64_vic_fetch(m, 0x0400) & 0xff) == m->ram[0x8400],
+            "cia2 didn't select bank 2");
+   }
+
+   // Quiet, these are meant to fail
+   int level = logLevel;
+   logLevel = LOG_NONE;
+
+   strcpy(path, "/tmp/sim_testsXXXXXX");
+   write_vsf(path, 100, 5);
+   CHECK(vsf_load(path, &state, m) != 0, "snapshot mid frame loaded");
+   unlink(path);
+
+   strcpy(path, "/tmp/sim_testsXXXXXX");
+   write_vsf(path, 300, 5);
+   CHECK(vsf_load(path, &state, m) == 0, "snapshot on line 300 didn't load");
+   unlink(path);
+
+   strcpy(path, "/tmp/sim_testsXXXXXX");
+   write_vsf(path, 0, 4);
+   CHECK(vsf_load(path, &state, m) != 0, "snapshot without VIC-II loaded");
+   unlink(path);
+
+   strcpy(path, "/tmp/sim_testsXXXXXX");
+   write_vsf(path, 0, 0);
+   CHECK(vsf_load(path, &state, m) != 0, "empty snapshot loaded");
+   unlink(path);
+
+   CHECK(vsf_load("/nonexistent.vsf", &state, m) != 0,
+         "missing snapshot loaded");
+
+   logLevel = level;
+   c64_free(m);
+}
+
+int main() {
+   test_timing();
+   test_branches();
+   test_decimal();
+   test_interrupts();
+   test_vic_fetch();
+   test_vsf();
+   test_statelog();
+   test_xxh64();
+   test_manifest();
+
+   printf ("%d checks, %d failed\n", checks, failures);
+   return failures ? 1 : 0;
+}